@@ -23,6 +23,7 @@ bool waterSpeedObj::handleMsg(message* inMsg) {
   if (inMsg->getPGN()==0x1F503) {
     rawSpeed = inMsg->getIntFromData(1);
     knots = speedMap.map(rawSpeed);
+    storeSignal(inMsg,0,0,knots);   // Post it for anyone else that wants it.
     return true;
   }
   return false;
@@ -82,6 +83,7 @@ bool waterTempObj::handleMsg(message* inMsg) {
       rawTemp = inMsg->getUIntFromData(3);   // Grab the data.
       kelvan = rawTemp / 100.0;              // Gives kelvan.
       degF  = (kelvan * 1.8) - 459.67;       // Gives degF. uPdate the value.
+      storeSignal(inMsg,inMsg->getDataByte(1),0,degF); // Post it, byte 1 is the temp instance.
       return true;                           // Success we handled that one. return true.
    }                                         //
    return false;                             // Not ours, return false.
@@ -206,6 +208,7 @@ bool airTempBarometer::handleMsg(message* inMsg) {
       success = true;
     }
    }
+   if (success) storeSignal(inMsg,0,0,inHg); // Post what we have now.
    return success;
 }
 
@@ -2,14 +2,17 @@
 #include "setup.h"
 #include "handlers.h"
 #include <lilParser.h>
+#include <signalStore.h>
 
 
 #define CAN_CS 10          // The chip select for the SPI connection to the CAN board.
 #define LIST_MS   30000    // How long before we decide we need to refresh address list?
 #define MAX_DEC   10       // Max digits beyond decimal point.
+#define NUM_SIGS  16       // How many last values we keep for whoever wants them.
 
 
 llama2000         llamaBrd;      // The class that inherits netObj, adding our attachmet to hardware.
+signalStore       lastValues(NUM_SIGS); // The handlers post what they read here.
 waterSpeedObj*    knotMeter;     // Handler to read boatspeed.
 waterTempObj*     thermometer;   // Handler to read water tempature.
 fluidLevelObj*    fuelSender;    // Handler that sends out fuel level messages.
@@ -49,6 +52,7 @@ void setup() {
    delay(10);
 
    // Creating and adding the message handlers.
+   llamaBrd.setSignalStore(&lastValues);
    knotMeter   = new waterSpeedObj(&llamaBrd);
    thermometer = new waterTempObj(&llamaBrd);
    fuelSender  = new fluidLevelObj(&llamaBrd);
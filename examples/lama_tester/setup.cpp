@@ -10,6 +10,7 @@ llama2000::llama2000(byte inECUInst, int inResetPin, int inIntPin)
 
   resetPin = inResetPin;  // We have a reset pin.
   intPin   = inIntPin;    // And an interrupt pin. Not used in this version.
+  canRunning = false;     // Hardware's not started yet.
 }
 
 
@@ -28,6 +29,7 @@ bool llama2000::begin(int inCSPin) {
    aName.setVehSys(DEV_CLASS_INST);             // What system are we in? Example : We are being an instrument.
    aName.setSystemInst(0);                      // We are the first of our system class.
    aName.setIndGroup(Marine);                   // What kind of machine are we ridin' on? Boat? Tractor?
+   setFilterLimit(1);                           // The CAN library gives us one filter and mask pair.
    netObj::begin(&aName, DEF_ADDR, ADDR_CAT);   // Here's our name, default address and address category.
    pinMode(resetPin, OUTPUT);                   // Setup our reset pin.
    delay(50);                                   // Sit for a bit..
@@ -35,7 +37,24 @@ bool llama2000::begin(int inCSPin) {
    delay(50);                                   // Set for a bit, again.
    digitalWrite(resetPin, HIGH);                // Flick it high and leave it there.
    hookup();                                    // Hook ourselves into the ideler queue.
-   return CAN.begin(500E3);                     // Fire up the hardware.
+   canRunning = CAN.begin(500E3);               // Fire up the hardware.
+   filtersChanged();                            // Now it can take our filter.
+   return canRunning;                           // And tell 'em how it went.
+}
+
+
+// The netObj works out what we need to hear, from our handlers and our address. Load
+// that into the MCP2515 and it throws away the rest. The CAN library only lets us set
+// the one filter, so we asked for one. NOTE : Handlers added without a PGN want
+// everything. Then the filter lets everything in.
+void llama2000::filtersChanged(void) {
+
+   canFilter   aFilter;
+   
+   if (canRunning) {                                  // Can't load it 'till the chip's running.
+      aFilter = getFilter(0);                         // The only one.
+      CAN.filterExtended(aFilter.id, aFilter.mask);   // In it goes.
+   }
 }
 
 
@@ -76,28 +95,39 @@ void llama2000::sendMsg(message* outMsg) {
 
 
 // The receiving gateway from NEMA2000/SAE J1939 protocol to the actual CAN bus hardware.
-void llama2000::recieveMsg(void) {
+// The frame goes into the netObj's receive ring with rxFrame(). No message object, no
+// heap. Returns false if there was nothing to read.
+bool llama2000::recieveMsg(void) {
 
-   message newMsg;
+   byte  data[8];
+   int   numBytes;
    int   i;
    
    if (CAN.parsePacket()) {                                    // If we got a parsable packet..
-      newMsg.setCANID(CAN.packetId());                         // Let our message objet Decode and store the packet for us.
-      newMsg.setNumBytes(CAN.packetDlc());                     // Read and set up message's data buffer. (Up to 8 Bytes)
+      numBytes = CAN.packetDlc();                              // How many data bytes it says it has.
+      if (numBytes > 8) numBytes = 8;                          // CAN can't do more than eight.
       i = 0;                                                   // Starting at zero..
-      while (CAN.available() && i < newMsg.getNumBytes()) {    // While we have a byte to read and a place to put it..
-         newMsg.setDataByte(i, CAN.read());                    // Read and store the byte into the message.
+      while (CAN.available() && i < numBytes) {                // While we have a byte to read and a place to put it..
+         data[i] = CAN.read();                                 // Read and store the byte.
          i++;                                                  // Bump of the storage index.
       }                                                        //
-      incomingMsg(&newMsg);                                    // All stored, let our netObj deal with it.
+      rxFrame(CAN.packetId(), i, data);                        // All stored, let our netObj deal with it.
+      return true;                                             // We got one.
    }
+   return false;                                               // Nothing there.
 }
 
 
 // This machine runs on idle time. The way it is currently written here it automatically
 // polls for messages every time idle() is called. Typically through your loop() function.
+// The CAN chip only holds a couple frames, so we read all it has, up to a limit, before
+// letting the netObj have its turn. On a busy bus that's the difference between keeping
+// up and losing frames whenever loop() does something slow.
 void llama2000::idle(void) {
 
+   int   i;
+   
+   i = 0;
+   while (i < RX_FRAMES_PER_IDLE && recieveMsg()) i++;
    netObj::idle();
-   recieveMsg();
 }
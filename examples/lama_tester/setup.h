@@ -11,6 +11,7 @@
 
 #define DEF_2515_RST_PIN   8
 #define DEF_2515_INT_PIN   2
+#define RX_FRAMES_PER_IDLE 16   // Most frames we pull from the CAN chip per idle(). It only holds a couple.
 
 
 // ************ llama2000 ************
@@ -80,12 +81,14 @@ class llama2000 : public netObj {
    
    virtual  bool  begin(int inCSPin);
    virtual  void  sendMsg(message* outMsg);
-   virtual  void  recieveMsg(void);
+   virtual  bool  recieveMsg(void);
    virtual  void  idle(void);
+   virtual  void  filtersChanged(void);
    
    protected:
-   int     resetPin; // Reset pin, you need this.
-   int     intPin;   // inturrupt pin. Optional. Not used here.  
+   int     resetPin;    // Reset pin, you need this.
+   int     intPin;      // inturrupt pin. Optional. Not used here.  
+   bool    canRunning;  // Hardware's up, we can load filters into it.
 };
 
 
@@ -0,0 +1,216 @@
+#include <idlers.h>
+#include <SAE_J1939.h>
+#include <faultStage.h>
+
+
+// How well do big transfers hold up when the bus drops frames? This runs two netObjs in
+// the one processor, wired back to back through a pair of faultStages. No CAN hardware
+// needed. Each loss rate gets a batch of broadcast (BAM) transfers and a batch of peer to
+// peer (RTS/CTS) transfers. Then it prints how it went over Serial.
+//
+// goodput  : Bytes that arrived intact, per second.
+// done     : How many of the transfers made it.
+// frames   : Frames on the wire, both ways, per data packet actually needed. 1.00 would be
+//            perfect. Retries, control frames and resends all push it up.
+//
+// Same SEED, same faults, same numbers. Change it to see a different run of luck.
+
+
+#define SENDER_ADDR  40       // Who sends.
+#define RECVR_ADDR   41       // Who gets.
+#define XFER_BYTES   400      // How big each transfer is.
+#define NUM_XFERS    10       // How many per test.
+#define XFER_MS      30000    // Give up on one after this long.
+#define SETTLE_MS    1000     // After the sender's done, let the last frames land.
+#define SEED         1939     // The dice.
+#define BAM_PGN      0x1FF00  // Proprietary B, broadcast.
+#define P2P_PGN      0x0EF00  // Proprietary A, peer to peer.
+
+
+float lossRates[] = { 0, 1, 2, 5, 10, 20 };
+#define NUM_RATES (sizeof(lossRates)/sizeof(lossRates[0]))
+
+
+// ************ benchNet ************
+
+
+// One side of the bench. Frames going out are handed to our faultStage, not hardware.
+class benchNet : public netObj {
+
+   public:
+   benchNet(void) : netObj() { wire = NULL; framesSent = 0; }
+
+   virtual  void  sendMsg(message* outMsg) {
+
+      framesSent++;                 // Count it.
+      if (wire) wire->push(outMsg); // Out onto the bench "wire".
+   }
+
+   faultStage* wire;       // Where our frames go.
+   uint32_t    framesSent; // How many we've put out.
+};
+
+
+// ************ linkStage ************
+
+
+// The far end of a faultStage. What makes it through lands in the other netObj.
+class linkStage : public faultStage {
+
+   public:
+   linkStage(void) : faultStage() { dest = NULL; }
+
+   virtual  void  output(message* outMsg) { if (dest) dest->incomingMsg(outMsg); }
+
+   netObj*  dest;   // Who's on the other end.
+};
+
+
+// ************ benchSink ************
+
+
+// Sits on the receiver and checks every transfer that shows up.
+class benchSink : public msgHandler {
+
+   public:
+   benchSink(netObj* inNetObj) : msgHandler(inNetObj) { goodXfers = 0; goodBytes = 0; }
+
+   virtual  bool  handleMsg(message* inMsg) {
+
+      uint32_t PGN;
+      int      numBytes;
+
+      PGN = inMsg->getPGN();
+      if (PGN!=BAM_PGN && (PGN&0x3FF00)!=P2P_PGN) return false;   // Not ours.
+      numBytes = inMsg->getNumBytes();
+      if (numBytes!=XFER_BYTES) return true;                      // Wrong size, no credit.
+      for (int i=0;i<numBytes;i++) {                              // Check every byte.
+         if (inMsg->getDataByte(i)!=pattern(i)) return true;      // One's off, no credit.
+      }
+      goodXfers++;
+      goodBytes = goodBytes + numBytes;
+      return true;
+   }
+
+   static byte pattern(int index) { return (index*7+3)&0xFF; }
+
+   uint32_t goodXfers;  // Transfers that arrived intact.
+   uint32_t goodBytes;  // And their bytes.
+};
+
+
+benchNet    sender;
+benchNet    receiver;
+linkStage   toRecvr;    // sender -> receiver
+linkStage   toSender;   // receiver -> sender
+benchSink*  sink;
+
+
+// Let everything run for a while.
+void waitMs(unsigned long ms) {
+
+   unsigned long startMs;
+
+   startMs = millis();
+   while(millis()-startMs<ms) idle();
+}
+
+
+// Send one transfer and wait for it to be over.
+void sendOne(bool peerToPeer) {
+
+   message        msg(XFER_BYTES);
+   xferHandle     handle;
+   unsigned long  startMs;
+
+   for (int i=0;i<XFER_BYTES;i++) {
+      msg.setDataByte(i,benchSink::pattern(i));
+   }
+   msg.setPriority(7);
+   msg.setSourceAddr(SENDER_ADDR);
+   if (peerToPeer) {
+      msg.setPGN(P2P_PGN);
+      msg.setPDUs(RECVR_ADDR);
+   } else {
+      msg.setPGN(BAM_PGN);
+   }
+   if (!sender.sendXfer(&msg,&handle)) return;
+   startMs = millis();
+   while(!handle.isDone() && millis()-startMs<XFER_MS) idle();
+   waitMs(SETTLE_MS);
+}
+
+
+// One batch, at one loss rate.
+void runTest(bool peerToPeer,float lossPct) {
+
+   unsigned long  startMs;
+   unsigned long  elapsedMs;
+   uint32_t       minFrames;
+   uint32_t       wireFrames;
+
+   toRecvr.seed(SEED);                    // Same dice every time.
+   toSender.seed(SEED+1);                 //
+   toRecvr.setLoss(lossPct);              // Both directions lose.
+   toSender.setLoss(lossPct);             //
+   sink->goodXfers = 0;                   // Clear the counts.
+   sink->goodBytes = 0;                   //
+   sender.framesSent = 0;                 //
+   receiver.framesSent = 0;               //
+   startMs = millis();
+   for (int i=0;i<NUM_XFERS;i++) {
+      sendOne(peerToPeer);
+   }
+   elapsedMs = millis()-startMs;
+   toRecvr.setLoss(0);                    // Back to a quiet bus.
+   toSender.setLoss(0);                   //
+   waitMs(SETTLE_MS);                     // Let any leftovers clear out.
+
+   minFrames   = ((XFER_BYTES+6)/7)*(uint32_t)NUM_XFERS;
+   wireFrames  = sender.framesSent+receiver.framesSent;
+   Serial.print(peerToPeer ? F("P2P   ") : F("BAM   "));
+   Serial.print(lossPct,0);
+   Serial.print(F("\t"));
+   Serial.print(1000.0*sink->goodBytes/elapsedMs,1);
+   Serial.print(F("\t\t"));
+   Serial.print(sink->goodXfers);
+   Serial.print(F("/"));
+   Serial.print(NUM_XFERS);
+   Serial.print(F("\t"));
+   Serial.println((float)wireFrames/minFrames,2);
+}
+
+
+void setup() {
+
+   Serial.begin(115200);
+   delay(10);
+
+   sender.wire    = &toRecvr;       // Wire 'em up back to back.
+   receiver.wire  = &toSender;      //
+   toRecvr.dest   = &receiver;      //
+   toSender.dest  = &sender;        //
+   toRecvr.hookup();                // The stages let delayed frames go in idle().
+   toSender.hookup();               //
+   toRecvr.setDelay(1,2);           // A little bus latency. Keeps the two sides from
+   toSender.setDelay(1,2);          // calling straight into each other, too.
+
+   sink = new benchSink(&receiver);
+   receiver.addMsgHandler(sink);
+   sender.begin(SENDER_ADDR,nonConfig);
+   receiver.begin(RECVR_ADDR,nonConfig);
+   waitMs(500);                     // Let them both get to running.
+
+   Serial.println(F("xfer_bench"));
+   Serial.print(F("bytes/xfer: ")); Serial.print(XFER_BYTES);
+   Serial.print(F("  xfers/test: ")); Serial.println(NUM_XFERS);
+   Serial.println(F("type  loss%  goodput(B/s)  done   frames"));
+   for (byte i=0;i<NUM_RATES;i++) {
+      runTest(false,lossRates[i]);
+      runTest(true,lossRates[i]);
+   }
+   Serial.println(F("Finished."));
+}
+
+
+void loop() { idle(); }
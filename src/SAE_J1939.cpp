@@ -1,4 +1,5 @@
 #include <SAE_J1939.h>
+#include <signalStore.h>
 
 bool showReq = false;
 
@@ -129,6 +130,215 @@ uint64_t packU64(byte hiByte,byte byte6,byte byte5,byte byte4,byte byte3,byte by
 
 
 uint64_t packU64(byte hiByte,byte byte6,byte byte5,byte byte4,byte byte3,byte byte2,byte byte1, byte lowByte);
+
+
+
+// ***************************************************************************************
+//				         -----    xferBuff   &  buffChunk    -----
+// ***************************************************************************************
+//				                -----    buffChunk    -----
+
+
+// We are handed an allocated block. It's ours now.
+buffChunk::buffChunk(byte* inData,uint32_t inNumBytes)
+	: linkListObj() {
+
+	data		= inData;
+	numBytes	= inNumBytes;
+}
+
+
+// And we recycle it when we go.
+buffChunk::~buffChunk(void) { resizeBuff(0,&data); }
+
+
+
+//				                -----    xferBuff    -----
+
+
+xferBuff::xferBuff(void)
+	: linkList() {
+
+	numBytes		= 0;		// Nothing yet.
+	lastChunk	= NULL;	// No chunk to remember.
+	lastStart	= 0;		//
+	refCount		= 1;		// Whoever made us, holds us.
+	shared		= false;	// Not shared 'till someone says so.
+}
+
+
+// The linkList recycles the chunks for us.
+xferBuff::~xferBuff(void) {  }
+
+
+// Dump what we have and allocate room for inNumBytes. Chunk by chunk. If we run out of RAM
+// part way through, we give it all back and return false.
+bool xferBuff::setNumBytes(uint32_t inNumBytes) {
+
+	buffChunk*	newChunk;
+	byte*			chunkData;
+	uint32_t		chunkBytes;
+	uint32_t		total;
+	
+	dumpList();															// Recycle whatever we had.
+	numBytes		= 0;													// Which was..
+	lastChunk	= NULL;												// Nothing to remember.
+	lastStart	= 0;													//
+	total			= 0;													// Nothing allocated yet.
+	while(total<inNumBytes) {										// While we need more room..
+		chunkBytes = inNumBytes - total;							// What's left to allocate.
+		if (chunkBytes>XFER_CHUNK_BYTES) {						// If it's more than a chunk..
+			chunkBytes = XFER_CHUNK_BYTES;						// Then it's a chunk.
+		}																	//
+		chunkData = NULL;												// resizeBuff() wants a NULL to start.
+		if (!resizeBuff(chunkBytes,&chunkData)) {				// If we can't get the RAM..
+			dumpList();													// Give back what we got.
+			return false;												// And fail.
+		}																	//
+		newChunk = new buffChunk(chunkData,chunkBytes);		// Wrap it in a chunk.
+		if (!newChunk) {												// No RAM for the wrapper?
+			resizeBuff(0,&chunkData);								// Recycle the data block.
+			dumpList();													// Give back what we got.
+			return false;												// And fail.
+		}																	//
+		addToEnd(newChunk);											// Chunks go in order.
+		total = total + chunkBytes;								// Count it.
+	}																		//
+	numBytes = inNumBytes;											// We made it.
+	return true;														// Success!
+}
+
+
+// How many bytes do we hold?
+uint32_t xferBuff::getNumBytes(void) { return numBytes; }
+
+
+// Someone has an allocated block (Typically from message::passData()) and wants us to own
+// it. It becomes our one and only chunk. No copying.
+void xferBuff::adoptData(byte* inData,uint32_t inNumBytes) {
+
+	setNumBytes(0);												// Recycle what we have.
+	if (inData && inNumBytes) {								// If they actually gave us something..
+		addToTop(new buffChunk(inData,inNumBytes));		// Wrap it and stuff it in.
+		numBytes = inNumBytes;									// And that's our size.
+	}
+}
+
+
+// If we are a single chunk, we can hand over our data as one plain block. We end up empty.
+// Multiple chunks can't be done this way so we pass back NULL and keep it all.
+byte* xferBuff::passData(void) {
+
+	buffChunk*	theChunk;
+	byte*			dataPtr;
+	
+	if (shared) return NULL;									// Others are reading it. It stays.
+	theChunk = (buffChunk*)getFirst();						// Grab the first chunk.
+	if (theChunk && !theChunk->getNext()) {				// If it's the only chunk..
+		dataPtr = theChunk->data;								// Grab the data.
+		theChunk->data = NULL;									// The chunk no longer owns it.
+		setNumBytes(0);											// Recycle the empty chunk.
+		return dataPtr;											// And pass the data on.
+	}																	//
+	return NULL;													// Sorry, can't do it.
+}
+
+
+// Find the chunk holding this index. Sequential access is the common case, so we look at
+// the last chunk we used first, then the one after that. Only then do we start over from
+// the top.
+buffChunk* xferBuff::findChunk(uint32_t index) {
+
+	buffChunk*	trace;
+	uint32_t		start;
+	
+	if (index>=numBytes) return NULL;											// Off the end? Nope.
+	if (lastChunk && index>=lastStart) {										// If we can start from the last one..
+		trace = lastChunk;															// Start there.
+		start = lastStart;															//
+	} else {																				// Else, it's back to the top.
+		trace = (buffChunk*)getFirst();											// First chunk.
+		start = 0;																		// Starts at zero.
+	}																						//
+	while(trace && index>=start+trace->numBytes) {							// While it's not in this chunk..
+		start = start + trace->numBytes;											// Slide the start along.
+		trace = (buffChunk*)trace->getNext();									// Next chunk.
+	}																						//
+	if (trace) {																		// If we found it..
+		lastChunk = trace;															// Remember where.
+		lastStart = start;															//
+	}																						//
+	return trace;																		// Pass it back.
+}
+
+
+// Read a byte. Reading off the end gives back 0xFF. The "unused" value.
+byte xferBuff::getByte(uint32_t index) {
+
+	buffChunk*	theChunk;
+	
+	theChunk = findChunk(index);
+	if (theChunk) {
+		return theChunk->data[index-lastStart];
+	}
+	return 0xFF;
+}
+
+
+// Write a byte. Writing off the end is just ignored. So is writing to a shared buffer.
+// Others are reading it.
+void xferBuff::setByte(uint32_t index,byte inByte) {
+
+	buffChunk*	theChunk;
+	
+	if (shared) return;
+	theChunk = findChunk(index);
+	if (theChunk) {
+		theChunk->data[index-lastStart] = inByte;
+	}
+}
+
+
+// For those writing a lot in order. Here's a pointer straight to the byte at index, and in
+// runBytes, how many bytes from there on are in the same chunk. Shared or off the end,
+// you get NULL.
+byte* xferBuff::getRun(uint32_t index,uint32_t* runBytes) {
+
+	buffChunk*	theChunk;
+	
+	*runBytes = 0;
+	if (shared) return NULL;
+	theChunk = findChunk(index);
+	if (theChunk) {
+		*runBytes = theChunk->numBytes - (index-lastStart);
+		return &(theChunk->data[index-lastStart]);
+	}
+	return NULL;
+}
+
+
+// From here on we're read only. Can't be undone.
+void xferBuff::share(void) { shared = true; }
+
+
+bool xferBuff::isShared(void) { return shared; }
+
+
+// One more holding onto us.
+void xferBuff::retain(void) { refCount++; }
+
+
+// One less holding onto us. When it's no one, we go. Don't touch the pointer after
+// calling this. It may well be gone.
+void xferBuff::release(void) {
+
+	refCount--;
+	if (refCount<=0) {
+		delete(this);
+	}
+}
+
+
 	
 // ***************************************************************************************
 //				----- message class -----
@@ -140,6 +350,24 @@ bool	isBlank(uint16_t inVal) { return inVal==0xFFFF; }
 bool	isBlank(uint32_t inVal) { return inVal==0xFFFFFFFF; }
 
 
+// If it's a PDU1, peer to peer type PGN, the low byte is the destination. Clear it.
+uint32_t basePGN(uint32_t PGN) {
+
+	if (((PGN>>8) & 0xFF)<240) {	// PDUf is the second byte. Less than 240? PDU1.
+		return PGN & 0x3FF00;		// Lose the destination.
+	}
+	return PGN & 0x3FFFF;			// PDU2, it's all PGN.
+}
+
+
+// Same ranges message::isBroadcast() checks. PDU2, with R clear, or sent to everyone.
+bool isBroadcastPGN(uint32_t PGN) {
+
+	if (PGN<=0x1FFFF && ((PGN>>8) & 0xFF)>=240) return true;	// PDU2, always a broadcast.
+	return (PGN & 0xFF)==GLOBAL_ADDR;									// PDU1 to everyone is too.
+}
+
+
 message::message(int inNumBytes) {
 		
 		priority		= DEF_PRIORITY;	// Something to get us going.
@@ -150,6 +378,7 @@ message::message(int inNumBytes) {
 		sourceAddr	= 0;					// Who sent this?
 		numBytes		= 0;					// Because now, it is.
 		msgData		= NULL;				// Default so we can use resizeBuff().
+		msgBuff		= NULL;				// No chunked buffer.
 		setNumBytes(inNumBytes);		// Set the default size.
 }
 
@@ -158,10 +387,26 @@ message::message(message* inMsg) {
 
 	numBytes		= 0;										// Because now, it is.
 	msgData = NULL;										// Default so we can use resizeBuff().
-	setNumBytes(inMsg->getNumBytes());				// Set the default size.
-	for (int i=0;i<numBytes;i++) {
-		setDataByte(i,inMsg->getDataByte(i));
-	}	
+	msgBuff = NULL;										// No chunked buffer.
+	if (inMsg->getBuff() && inMsg->getBuff()->isShared()) {	// Shared buffer? No copy needed.
+		shareBuff(inMsg->getBuff());								// We just hold on to it too.
+	} else if (inMsg->getBuff()) {					// If they have a chunked buffer..
+		attachBuff(new xferBuff());					// We get one too.
+		if (msgBuff) {										// If we got it..
+			if (msgBuff->setNumBytes(inMsg->getNumBytes())) {	// And the RAM to fill it..
+				numBytes = inMsg->getNumBytes();						// That's our size.
+			} else {															// Else, out of RAM.
+				setNumBytes(0);											// We end up with nothing.
+			}
+		}
+	} else {
+		setNumBytes(inMsg->getNumBytes());				// Set the default size.
+	}
+	if (!msgBuff || !msgBuff->isShared()) {			// Shared has it already.
+		for (int i=0;i<numBytes;i++) {
+			setDataByte(i,inMsg->getDataByte(i));
+		}
+	}
 	setPriority(inMsg->getPriority());
 	setR(inMsg->getR());
 	setDP(inMsg->getDP());
@@ -176,6 +421,11 @@ message::~message(void) { setNumBytes(0); }
 		
 void message::setNumBytes(int inNumBytes) {
 
+	if (msgBuff) {					// If we are holding a chunked buffer..
+		msgBuff->release();		// It goes. We are back to a plain one.
+		msgBuff = NULL;			//
+		numBytes = 0;				// Which is empty.
+	}
 	if (inNumBytes != numBytes) {
 		if (resizeBuff(inNumBytes,&msgData)) {
 			numBytes = inNumBytes;
@@ -282,15 +532,28 @@ void message::setSourceAddr(byte inSourceAddr) { sourceAddr = inSourceAddr; }
 byte message::getSourceAddr(void) { return sourceAddr; }
 
 
-void message::setDataByte(int index,byte inByte) { msgData[index] = inByte; }
+// Chunked or not, these two get you to the data.
+void message::setDataByte(int index,byte inByte) {
+
+	if (msgBuff) {
+		msgBuff->setByte(index,inByte);
+	} else {
+		msgData[index] = inByte;
+	}
+}
+
 
+byte message::getDataByte(int index) {
 
-byte message::getDataByte(int index) { return msgData[index]; }
+	if (msgBuff) return msgBuff->getByte(index);
+	return msgData[index];
+}
 
 
 // This one passes the pointer to our data buffer to someone else and TRUSTS them to NOT
 // MESS WITH IT. For educational purposes only! Actually, this is used in the commanded
-// address stuff to see who the command is actually adressed to. Non-destructively.
+// address stuff to see who the command is actually adressed to. Non-destructively. If
+// our data lives in a chunked buffer, there is no one block to peek at. You get NULL.
 byte* message::peekData(void) { return msgData; }
 
 
@@ -302,6 +565,15 @@ byte* message::passData(void) {
 
 	byte*	dataPtr;
 	
+	if (msgBuff) {								// If we are chunked..
+		dataPtr = msgBuff->passData();	// It can only be done if it's all one chunk.
+		if (dataPtr) {							// If it worked..
+			msgBuff->release();				// The empty buffer goes.
+			msgBuff = NULL;					//
+			numBytes = 0;						// And we have nothing.
+		}											// If it didn't, we keep it all.
+		return dataPtr;						// Either way, here's the result.
+	}
 	dataPtr = msgData;	// Grab the data's address.
 	msgData = NULL;		// NULL out our pointer to it.
 	numBytes = 0;			// zero out our amount of data.
@@ -320,6 +592,65 @@ void message::acceptData(byte* inData,int inNumBytes) {
 }
 
 
+// Same idea as acceptData() but for chunked transfer buffers. This is how the really big
+// extended transport messages carry their data around. We own it now.
+void message::attachBuff(xferBuff* inBuff) {
+
+	setNumBytes(0);								// Recycle ours.
+	msgBuff = inBuff;								// Point at theirs.
+	if (msgBuff) {									// If it's real..
+		numBytes = msgBuff->getNumBytes();	// That's our size.
+	}
+}
+
+
+// Hand our chunked buffer off to someone else. Like passData(), we end up empty.
+xferBuff* message::passBuff(void) {
+
+	xferBuff*	buffPtr;
+	
+	buffPtr = msgBuff;	// Grab the buffer.
+	msgBuff = NULL;		// It's no longer ours.
+	numBytes = 0;			// So we have no data.
+	return buffPtr;		// There you go.
+}
+
+
+// Do we have a chunked buffer? NULL means no, the data is in one plain block.
+xferBuff* message::getBuff(void) { return msgBuff; }
+
+
+// Freeze our data into a shared buffer. After this, sending us doesn't take our data away.
+// Each transfer just holds onto the buffer 'till it's done with it. Build one response,
+// send it to everyone that asked. The data can't be changed from here on. Hand back the
+// buffer so others can shareBuff() it. Out of RAM gives back NULL.
+xferBuff* message::shareData(void) {
+
+	xferBuff*	newBuff;
+	int			savedBytes;
+	
+	if (!msgBuff) {										// Plain block?
+		newBuff = new xferBuff();						// Needs a buffer to live in.
+		if (!newBuff) return NULL;						// No RAM? No sharing.
+		savedBytes = numBytes;							// passData() zeros this.
+		newBuff->adoptData(passData(),savedBytes);	// Buffer takes over our data.
+		attachBuff(newBuff);								// And we hold the buffer.
+	}															//
+	msgBuff->share();										// Frozen.
+	return msgBuff;										// Here it is.
+}
+
+
+// Point at someone's shared buffer as our data. We take a reference, they keep theirs.
+void message::shareBuff(xferBuff* inBuff) {
+
+	if (inBuff && inBuff->isShared()) {			// Only shared buffers please..
+		inBuff->retain();									// We're holding it too.
+		attachBuff(inBuff);								// It's our data now.
+	}
+}
+
+
 // Put an int into the data buffer starting at index.
 void message::setIntInData(int startIndex,int16_t value) {
 	
@@ -549,6 +880,47 @@ bool message::isBroadcast(void) {
 }
 
 
+bool message::isPDU1(void) { return PDUf<240; }
+
+
+// Only the top end of the PDUf range means anything special. So the table starts at ETP
+// data (199) and runs up to commanded address (254). Anything outside that is application
+// data. One compare, one look up.
+#define PF_TABLE_FIRST	ETP_DATA_XFER_PF
+#define PF_TABLE_LAST	COMMAND_ADDR_PF
+
+static const uint8_t pfClassTable[PF_TABLE_LAST-PF_TABLE_FIRST+1] = {
+	tpDataFrame,	tpConFrame,																			// 199 ETP data,   200 ETP connection.
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 201..205
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 206..210
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 211..215
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 216..220
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 221..225
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 226..230
+	appFrame,																								// 231
+	ackFrame,		appFrame,		requestFrame,	tpDataFrame,	tpConFrame,		// 232 ack, 233, 234 request, 235 TP data, 236 TP connection.
+	appFrame,		claimFrame,																			// 237, 238 address claimed.
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 239..243
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 244..248
+	appFrame,		appFrame,		appFrame,		appFrame,		appFrame,		// 249..253
+	commandFrame																							// 254 commanded address. (Checked below)
+};
+
+
+// Just the ID. Sizes are left for whoever handles it to check.
+frameClass message::getClass(void) {
+
+	frameClass	aClass;
+	
+	if (PDUf<PF_TABLE_FIRST || PDUf>PF_TABLE_LAST) return appFrame;		// The bulk of them.
+	aClass = (frameClass)pfClassTable[PDUf-PF_TABLE_FIRST];					// Look it up.
+	if (aClass==commandFrame) {														// PDU2, so that PDUf is shared..
+		if (R || DP || PDUs!=(COMMAND_ADDR & 0xFF)) return appFrame;		// Only the one PGN is commanded address.
+	}																							//
+	return aClass;
+}
+
+
 void message::showMessage(void) {
 	
 	Serial.print("PGN           : "); Serial.println(getPGN(),HEX);
@@ -560,17 +932,17 @@ void message::showMessage(void) {
 	Serial.print("Source addr   : "); Serial.println(sourceAddr);
 	Serial.println("Data as bytes");
 	for (int i=0;i<numBytes;i++) {
-		Serial.print("[ ");Serial.print(msgData[i]);Serial.print(" ]");Serial.print('\t');
+		Serial.print("[ ");Serial.print(getDataByte(i));Serial.print(" ]");Serial.print('\t');
 	}
 	Serial.println();
 	Serial.println("Data as hex");
 	for (int i=0;i<numBytes;i++) {
-		Serial.print("[ 0x");Serial.print(msgData[i],HEX);Serial.print(" ]");Serial.print('\t');
+		Serial.print("[ 0x");Serial.print(getDataByte(i),HEX);Serial.print(" ]");Serial.print('\t');
 	}
 	Serial.println();
 	Serial.println("Data as text");
 	for (int i=0;i<numBytes;i++) {
-		Serial.print((char)(msgData[i]));
+		Serial.print((char)(getDataByte(i)));
 	}
 	Serial.println();
 }
@@ -1014,171 +1386,864 @@ void addrList::showList(bool withNames) {
 
 		
 // ***************************************************************************************
-//				          -----    xferList   &  xferNode    -----
+//				                   -----    txPacer    -----
 // ***************************************************************************************
 
 
+txPacer::txPacer(void) {
 
-// Setting up the base goodies. A copy of the initial message. Setting the complete
-// variable..
-xferNode::xferNode(netObj* inNetObj,xferList* inList)
-	: linkListObj() {
-	
-	success		= false;		// We start without success.
-	complete		= true;		// Let the offspring set this.
-	ourNetObj	= inNetObj;	// Save off our netObj pointer.
-	msgData		= NULL;		// Start all pointers we may allocate to NULL
-	byteTotal	= 0;			// None been sent. yet..
-	packNum		= 1;			// The packet number we'll be sending/expecting.
+	reset();
+	resetStats();
 }
-	
 
-// outData may have been used. If not NULL, we'll need to delete it.
-xferNode::~xferNode(void) {
 
-	if (msgData) {			// If someone set it..
-		free(msgData);		// We'll release it.
-		msgData = NULL;	// Flag it so no one else tries to release it.
-	}
-}
+txPacer::~txPacer(void) {  }
 
 
-// In an attempt to shut up the compiler, use this to decode a flow control data value to
-// an abort reason.
-abortReason	xferNode::valueToReason(byte value) {
+void txPacer::reset(void) {
 
-	switch(value) {
-		case notAbort			: return notAbort;		// Not because of a received abort. Mostly unexpected msg.
-		case busyAbort			: return busyAbort;
-		case resourceAbort	: return resourceAbort;
-		case timoutAbort		: return timoutAbort;
-		default 					: return noReason;
-	}
+	started	= false;
+	dueMs		= 0;
+	lastMs	= 0;
 }
 
 
-// We get in a message, let us sanity check it and then see if it is one sent specifically
-// to us. We default to not ours.
-bool xferNode::isOurMsg(message* inMsg) {
+void txPacer::resetStats(void) {
 
-	if (!complete && inMsg!=NULL) {									// First reality check.
-		if (inMsg->getPDUf()==FLOW_CON_PF) {						// If its flow control?
-			return checkFCID(inMsg);						// Check the ID bits.
-		} else if (inMsg->isBroadcast()) {							// If it's a broadcast?
-			return true;													// We'll ok broadcasts as well.
-		} else if (inMsg->getPDUs()==ourNetObj->getAddr()) {	// Not a broadcast, but addressed to us?
-			return true;													// That sounds good too!
-		}
-	}
-	return false;
+	gapLast	= 0;
+	gapMin	= 0;
+	gapMax	= 0;
+	numGaps	= 0;
 }
 
 
-// If no one is listenting? Then pass back false.
-bool xferNode::handleMsg(message* inMsg) { return false; }
+bool txPacer::isDue(void) { return msToGo()==0; }
 
 
-// Start the timer with a time in ms somewhere between these two values.
-void xferNode::startTimer(int lowMs,int hiMs) {
-	
-	long timeMs;
+long txPacer::msToGo(void) {
+
+	long	togo;
 	
-	timeMs = random(lowMs, hiMs+1);
-	xFerTimer.setTime(timeMs,true);
+	if (!started) return 0;									// Nothing sent, nothing to wait for.
+	togo = (long)(dueMs-millis());						// Signed, so it survives rollover.
+	if (togo<0) return 0;									// Past due? It's now.
+	return togo;
 }
 
 
-// Add a completed incoming msg to the list of incoming messages.
-void xferNode::addMsgToQ(message* msg) {
+// We just sent a packet. Note the gap we actually got, then set the next deadline off the
+// last one. Unless that would squeeze it closer than minGapMs to this one.
+void txPacer::markSent(int gapMs,int minGapMs) {
 
-	msgObj*	newMsg;
+	unsigned long	now;
+	unsigned long	gap;
 	
-	newMsg = new msgObj(msg);					// Make up a msgObj.
-	if (newMsg) {									// Got one?
-		ourNetObj->ourMsgQ.push(newMsg);		// Stuff it into the queue.
-	}
+	now = millis();
+	if (started) {												// We have a last one?
+		gap = now-lastMs;										// Here's the gap we got.
+		gapLast = gap;											//
+		if (!numGaps || gap<gapMin) gapMin = gap;		//
+		if (gap>gapMax) gapMax = gap;						//
+		numGaps++;												//
+	} else {														// First one?
+		dueMs = now;											// Deadlines start from here.
+	}																//
+	dueMs = dueMs+gapMs;										// Next one's due here.
+	if ((long)(dueMs-(now+minGapMs))<0) {				// But if we're running late..
+		dueMs = now+minGapMs;								// No closer than this.
+	}																//
+	lastMs = now;												// Remember when.
+	started = true;											//
 }
 
 
-// Send data message. All the info needed to do this should be in our local globals.
-bool xferNode::sendDataMsg(void) {
 
-	message	dataMsg;
+// ***************************************************************************************
+//				                 -----    bandwidthMgr    -----
+// ***************************************************************************************
 
-	dataMsg.setPriority(DEF_TP_PRIORITY);						// Set up the standard bits..
-	dataMsg.setR(0);													// Reserve bit.
-	dataMsg.setDP(0);													// Data page.
-	dataMsg.setPDUf(DATA_XFER_PF);								// Data xFer message.
-	dataMsg.setPDUs(msgAddr);										// Broadcasting or peer to peer.
-	dataMsg.setSourceAddr(ourNetObj->getAddr());				// From us.
-	dataMsg.setDataByte(0,packNum++);							// Data packet ID.
-	for(int i=1;i<8;i++) {											// For each byte..
-		if (byteTotal>msgSize) {									// If we've run out of data..
-			dataMsg.setDataByte(i,0xFF);							// Data byte is flagged as 255.
-		} else {															// Else, we have data to send.
-			dataMsg.setDataByte(i,msgData[byteTotal++]);		// Write the data byte.
-		}																	//
-	}																		//
-	ourNetObj->outgoingingMsg(&dataMsg);						// And its on it's way!
-	return byteTotal>=msgSize;										// Return if this was the last or not.
+
+bandwidthMgr::bandwidthMgr(void) {
+
+	busRate	= BUS_BPS;								// J1939 speed.
+	burstMs	= BW_BURST_MS;							// Save up this much.
+	for (int i=0;i<bwNumClasses;i++) {			// Everyone starts..
+		share[i] = 0;									// With no limit.
+	}														//
+	share[bwTPData]	= BW_TP_PCT;				// Except the transport data..
+	share[bwBulk]		= BW_BULK_PCT;				// And the bulk.
+	for (int i=0;i<bwNumClasses;i++) {			// Buckets start..
+		tokens[i] = classRate((bwClass)i)*burstMs;	// Full.
+	}														//
+	lastMs = millis();								// As of now.
+	resetStats();										// No counts yet.
 }
 
 
-// We are either sending a oversize message or receiving one. In either case, there is an
-// initial message that starts all of this. Either and oversized message we are sending or
-// some sort of BAM message we are receiving. We use this and get the PGN so we can use
-// it later as a flow control message ID.
-void xferNode::saveFCID(message* initMsg) {
+bandwidthMgr::~bandwidthMgr(void) {  }
 
-	uint32_t	aPGN;
-	
-	if (initMsg) {														// Sanity, we actually got one.
-		if (initMsg->getPDUf()==FLOW_CON_PF) {					// Ok, it's flow control. We grab the three bytes from here.
-			xferPGN = initMsg->getData5PGN();					// We have this handy function for that.
-		} else {															// Else its NOT a flow control. Must be from us.
-			xferPGN = initMsg->getPGN();							// Messages know how to do this for themselves.
-		}
-		aPGN	= xferPGN;												// Copy the PGN, this is going to tear things apart..
-		byte5	= aPGN & 0x000000FF;									// Grab LSB
-		aPGN	= aPGN >> 8;											// Slide over PGN.
-		byte6	= aPGN & 0x000000FF;									// Grab MDB
-		aPGN	= aPGN >> 8;											// Slide over PGN.
-		byte7	= aPGN & 0x000000FF;									// Grab MSB
-	} else {																// Else? We're getting nutty parameters. Pull the plug.
-		success = false;												// This is NOT a success.
-		complete = true;												// We're done.
-		reason = notAbort;											// The other side did not abort this. The powers-that-be went bananas.
+
+void bandwidthMgr::setBusRate(uint32_t bitsPerSec) { busRate = bitsPerSec; }
+
+
+uint32_t bandwidthMgr::getBusRate(void) { return busRate; }
+
+
+void bandwidthMgr::setShare(bwClass aClass,uint8_t percent) {
+
+	if (percent>100) percent = 100;
+	share[aClass] = percent;
+	tokens[aClass] = classRate(aClass)*burstMs;	// Fresh bucket.
+}
+
+
+uint8_t bandwidthMgr::getShare(bwClass aClass) { return share[aClass]; }
+
+
+void bandwidthMgr::setBurst(int ms) {
+
+	if (ms<1) ms = 1;							// Need room for at least something.
+	burstMs = ms;
+}
+
+
+// An extended (29 bit ID) frame is 67 bits, counting the 3 bit space between frames, plus
+// eight per data byte. Then the CAN hardware stuffs in an extra bit after every five the
+// same. Worst case that's one for every four bits of everything up to the CRC.
+int bandwidthMgr::frameBits(int numBytes) {
+
+	if (numBytes<0) numBytes = 0;
+	if (numBytes>8) numBytes = 8;
+	return 67 + 8*numBytes + (53+8*numBytes)/4;
+}
+
+
+// Sort frames by what they're for.
+bwClass bandwidthMgr::classify(byte PDUf) {
+
+	switch(PDUf) {
+		case ACKNOWLEDGE_PF		:
+		case REQUEST_PF			:
+		case FLOW_CON_PF			:
+		case ETP_FLOW_CON_PF		:
+		case ADDR_CLAIMED_PF		: return bwNetMgmt;
+		case DATA_XFER_PF			: return bwTPData;
+		case ETP_DATA_XFER_PF	: return bwBulk;
+		default						: return bwPeriodic;
 	}
 }
-	
-	
-bool  xferNode::checkFCID(message* inMsg)	{
 
-	if (inMsg) {
-		
-		if (byte5 == inMsg->getDataByte(5)) {
-			if (byte6 == inMsg->getDataByte(6)) {
-				if (byte7 == inMsg->getDataByte(7)) {
-					return true;
-				}
-			}
+
+// bits/second is the same thing as 1/1000 bits per ms. Which is what the buckets count in.
+long bandwidthMgr::classRate(bwClass aClass) { return (long)(busRate/100)*share[aClass]; }
+
+
+// Add in what each bucket earned since last time. No more than they can hold. We cap the
+// time first so the multiply can't overflow after a long nap.
+void bandwidthMgr::refill(void) {
+
+	unsigned long	now;
+	unsigned long	elapsed;
+	long				cap;
+	
+	now = millis();
+	elapsed = now-lastMs;
+	if (!elapsed) return;
+	lastMs = now;
+	if (elapsed>(unsigned long)burstMs) elapsed = burstMs;
+	for (int i=0;i<bwNumClasses;i++) {
+		if (share[i]) {
+			cap = classRate((bwClass)i)*burstMs;
+			tokens[i] = tokens[i] + classRate((bwClass)i)*(long)elapsed;
+			if (tokens[i]>cap) tokens[i] = cap;
 		}
 	}
-	return false;
 }
-	
 
-// Send flowControl message.
-void xferNode::sendflowControlMsg(flowContType msgType,abortReason reason) {
 
-	message	flowContMsg;
-	uint16_t	aWord;
-	uint8_t	aByte;
-	
+// Anything in the bucket and you can send. A frame can take it below zero, then you wait
+// 'till it fills back up.
+bool bandwidthMgr::canSend(bwClass aClass) {
+
+	if (!share[aClass]) return true;		// No limit.
+	refill();
+	return tokens[aClass]>0;
+}
+
+
+long bandwidthMgr::msToSend(bwClass aClass) {
+
+	long	rate;
+	
+	if (canSend(aClass)) return 0;			// Now.
+	rate = classRate(aClass);					// Not zero, or we could send.
+	return (-tokens[aClass])/rate + 1;		// When it gets back above zero.
+}
+
+
+// A frame went out. Count it and, if its class is limited, take it out of the bucket.
+void bandwidthMgr::charge(message* inMsg) {
+
+	bwClass	aClass;
+	int		bits;
+	
+	aClass = classify(inMsg->getPDUf());
+	bits = frameBits(inMsg->getNumBytes());
+	bitsSent[aClass] = bitsSent[aClass] + bits;
+	framesSent[aClass]++;
+	if (share[aClass]) {
+		refill();
+		tokens[aClass] = tokens[aClass] - (long)bits*1000;
+	}
+}
+
+
+void bandwidthMgr::resetStats(void) {
+
+	for (int i=0;i<bwNumClasses;i++) {
+		bitsSent[i]		= 0;
+		framesSent[i]	= 0;
+	}
+}
+
+
+
+// ***************************************************************************************
+//				                   -----    xferRetry    -----
+// ***************************************************************************************
+
+
+xferRetry::xferRetry(void) {
+
+	maxTries			= RETRY_TRIES;
+	backoffMs		= RETRY_MS;
+	maxBackoffMs	= RETRY_MAX_MS;
+	needPeer			= false;		// Opt in. The address list may not know everyone yet.
+}
+
+
+xferRetry::~xferRetry(void) {  }
+
+
+
+// ***************************************************************************************
+//				                   -----    xferHandle    -----
+// ***************************************************************************************
+
+
+xferHandle::xferHandle(void) {
+
+	state			= handleIdle;
+	success		= false;
+	reason		= noReason;
+	tries			= 0;
+	numBytes		= 0;
+	bytesSent	= 0;
+	startMs		= 0;
+	elapsedMs	= 0;
+	ourNode		= NULL;
+}
+
+
+// If we go away while the transfer's running, it needs to know not to call us.
+xferHandle::~xferHandle(void) {
+
+	if (ourNode) {
+		ourNode->ourHandle = NULL;
+		ourNode = NULL;
+	}
+}
+
+
+// Inherit and fill this in to be called the moment it's done.
+void xferHandle::xferDone(void) {  }
+
+
+bool xferHandle::isDone(void) { return state==handleDone; }
+
+
+// While it's running we ask the transfer. After, it's what we saved.
+uint32_t xferHandle::getBytesSent(void) {
+
+	if (ourNode) {
+		if (ourNode->byteTotal<ourNode->msgSize) return ourNode->byteTotal;
+		return ourNode->msgSize;
+	}
+	return bytesSent;
+}
+
+
+unsigned long xferHandle::getElapsedMs(void) {
+
+	if (state==handleRunning) return millis()-startMs;
+	return elapsedMs;
+}
+
+
+// Starting a send with this handle.
+void xferHandle::begin(uint32_t inNumBytes) {
+
+	state			= handleRunning;
+	success		= false;
+	reason		= noReason;
+	tries			= 0;
+	numBytes		= inNumBytes;
+	bytesSent	= 0;
+	startMs		= millis();
+	elapsedMs	= 0;
+	ourNode		= NULL;
+}
+
+
+// It's over. Save how it went and let 'em know.
+void xferHandle::finish(bool inSuccess,abortReason inReason,uint32_t inBytes) {
+
+	success		= inSuccess;
+	reason		= inReason;
+	bytesSent	= inBytes;
+	elapsedMs	= millis()-startMs;
+	ourNode		= NULL;
+	state			= handleDone;
+	xferDone();
+}
+
+
+
+// ***************************************************************************************
+//				          -----    xferList   &  xferNode    -----
+// ***************************************************************************************
+
+
+
+// Setting up the base goodies. A copy of the initial message. Setting the complete
+// variable..
+xferNode::xferNode(netObj* inNetObj,xferList* inList)
+	: linkListObj() {
+	
+	success		= false;			// We start without success.
+	complete		= true;			// Let the offspring set this.
+	reason		= noReason;		// Nothing's gone wrong. Yet.
+	ourNetObj	= inNetObj;		// Save off our netObj pointer.
+	ourList		= inList;		// And our list.
+	fcPDUf		= FLOW_CON_PF;	// Regular transport, unless our offspring says otherwise.
+	dtPDUf		= DATA_XFER_PF;	//
+	msgBuff		= NULL;			// Start all pointers we may allocate to NULL
+	msgSize		= 0;				// No data yet.
+	msgPacks		= 0;				//
+	byteTotal	= 0;				// None been sent. yet..
+	packNum		= 1;				// The packet number we'll be sending/expecting.
+	winStart		= 0;				// ETP window stuff.
+	winPacks		= 0;				//
+	ourSink		= NULL;			// No one's streaming.
+	sinkBuff		= NULL;			//
+	incoming		= false;			// Incoming sessions set this when they ask for room.
+	rxPrio		= DEF_PRIORITY;	// Middle of the road.
+	holding		= false;			// Not holding anyone off.
+	holdCount	= 0;				//
+	lastMs		= millis();		// Just heard from them.
+	tries			= 0;				// No retries yet.
+	ourHandle	= NULL;			// No one's asked to hear about it.
+	toPeer		= false;			// Outgoing peer to peer sets this.
+	waitTurn		= false;			// Not waiting on anyone.
+	peerSeq		= 0;				//
+}
+	
+
+// msgBuff may have been used. If not NULL, we'll need to delete it. And if we were
+// streaming to a sink that's not been told how it ended, tell 'em now. Every failure ends
+// up here eventually.
+xferNode::~xferNode(void) {
+
+	finishHandle();									// Usually done() beat us to it.
+	if (ourSink) {										// Sink never got the news?
+		ourSink->endXfer(false,reason);			// It failed.
+		ourSink = NULL;								//
+	}
+	if (msgBuff) {			// If someone set it..
+		msgBuff->release();	// We'll release it.
+		msgBuff = NULL;	// Flag it so no one else tries to release it.
+	}
+}
+
+
+// In an attempt to shut up the compiler, use this to decode a flow control data value to
+// an abort reason.
+abortReason	xferNode::valueToReason(byte value) {
+
+	switch(value) {
+		case notAbort			: return notAbort;		// Not because of a received abort. Mostly unexpected msg.
+		case busyAbort			: return busyAbort;
+		case resourceAbort	: return resourceAbort;
+		case timoutAbort		: return timoutAbort;
+		default 					: return noReason;
+	}
+}
+
+
+// We get in a message, let us sanity check it and then see if it is one for us. It has to
+// come from who we're listening to. Then, flow control must carry our PGN, anything else
+// must be a broadcast. Peer to peer sessions use isPeerMsg(). We default to not ours.
+bool xferNode::isOurMsg(message* inMsg) {
+
+	if (!complete && inMsg!=NULL) {									// First reality check.
+		if (inMsg->getSourceAddr()==msgAddr) {						// From our guy?
+			if (inMsg->getPDUf()==FLOW_CON_PF) {					// If its flow control?
+				return checkFCID(inMsg);								// Check the ID bits.
+			} else if (inMsg->isBroadcast()) {						// If it's a broadcast?
+				return true;												// That's us.
+			}
+		}
+	}
+	return false;
+}
+
+
+// Peer to peer sessions want a tighter check. The message must come from our peer, be
+// addressed to us, and be either one of our data packets, or one of our flow control
+// messages carrying our PGN.
+bool xferNode::isPeerMsg(message* inMsg) {
+
+	if (!complete && !waitTurn && inMsg!=NULL) {							// First reality check. (Waiting our turn? Nothing's ours yet.)
+		if (inMsg->getSourceAddr()==msgAddr) {								// From our peer?
+			if (inMsg->getPDUs()==ourNetObj->getAddr()) {				// To us?
+				if (inMsg->getPDUf()==dtPDUf) return true;				// Our data packet. Yes.
+				if (inMsg->getPDUf()==fcPDUf) return checkFCID(inMsg);	// Flow control? Check the PGN bits.
+			}
+		}
+	}
+	return false;
+}
+
+
+// If no one is listenting? Then pass back false.
+bool xferNode::handleMsg(message* inMsg) { return false; }
+
+
+// Start the timer with a time in ms somewhere between these two values.
+void xferNode::startTimer(int lowMs,int hiMs) {
+	
+	long timeMs;
+	
+	timeMs = random(lowMs, hiMs+1);
+	xFerTimer.setTime(timeMs,true);
+}
+
+
+// Outgoing, grab the data out of the message we're sending. If it's chunked, we take the
+// whole chunked buffer. If not, we take the plain block and wrap it. Either way, no
+// copying and the message ends up empty. Unless it's shared. Then we just hold onto the
+// buffer with everyone else and the message keeps it.
+bool xferNode::takeData(message* inMsg) {
+
+	uint32_t	numBytes;
+	
+	numBytes = inMsg->getNumBytes();								// How much are we getting?
+	if (inMsg->getBuff() && inMsg->getBuff()->isShared()) {	// Shared?
+		msgBuff = inMsg->getBuff();								// Point at it.
+		msgBuff->retain();											// And hold on.
+	} else if (inMsg->getBuff()) {								// Chunked?
+		msgBuff = inMsg->passBuff();								// Take the buffer.
+	} else {																// Plain block?
+		msgBuff = new xferBuff();									// We need a buffer to hold it.
+		if (msgBuff) {													// Got one?
+			msgBuff->adoptData(inMsg->passData(),numBytes);	// It takes over the message's data.
+		}
+	}
+	return msgBuff!=NULL;
+}
+
+
+// Incoming, allocate room for msgSize bytes. Chunked if it's big.
+bool xferNode::allocData(void) {
+
+	msgBuff = new xferBuff();									// Get a buffer.
+	if (msgBuff) {													// Got one?
+		if (msgBuff->setNumBytes(msgSize)) {				// And got the RAM?
+			return true;											// Good to go.
+		}
+		msgBuff->release();										// No RAM, recycle the buffer.
+		msgBuff = NULL;											//
+	}
+	return false;													// And fail.
+}
+
+
+// Incoming, before grabbing RAM, see if there's a sink that wants this transfer. If it
+// takes it, we may get their buffer to fill. Otherwise we'll stream it to them.
+bool xferNode::openSink(void) {
+
+	xferSink*	aSink;
+	
+	aSink = ourList->findSink(xferPGN);						// Anyone want this PGN?
+	if (aSink) {													// Someone might..
+		if (aSink->beginXfer(msgAddr,msgSize)) {			// They do!
+			ourSink = aSink;										// Save 'em.
+			sinkBuff = ourSink->getBuffer(msgSize);		// Their buffer, or NULL to stream.
+			return true;											// We're set.
+		}
+	}
+	return false;													// Business as usual.
+}
+
+
+// Incoming, get somewhere to put the data. A sink first, then our own RAM if the budget
+// has room for it. No room now, but it would fit later? That's a wait.
+roomResult xferNode::getRoom(void) {
+
+	incoming = true;													// We're reassembling.
+	rxPrio = ourList->getPriority(xferPGN);					// How important are we?
+	lastMs = millis();												// Start the stall clock.
+	if (openSink()) return roomOK;								// Someone else is taking care of the RAM.
+	if (ourList->makeRoom(this)) {								// Budget says ok..
+		if (allocData()) return roomOK;							// And we got the RAM. Go!
+		return roomNone;												// Budget says ok, but there is no RAM. That's that.
+	}																		//
+	if (!ourList->getRxBudget()||msgSize<=ourList->getRxBudget()) {	// Would it ever fit?
+		return roomWait;												// Then hang on.
+	}																		//
+	return roomNone;													// Too big for the budget. Never going to happen.
+}
+
+
+// We're holding off a peer 'till there's room. Each time the hold timer runs out, call
+// this. If room shows up we return true and the caller gets things started. If not,
+// we send another hold. Or give up if we've been at it too long.
+bool xferNode::waitRoom(void) {
+
+	if (ourList->makeRoom(this) && allocData()) {			// Room now?
+		lastMs = millis();											// Restart the stall clock.
+		return true;													// Go!
+	}																		//
+	if (holdCount>=XFER_MAX_HOLDS) {								// Been holding too long?
+		reason = resourceAbort;										// Never got the RAM.
+		sendflowControlMsg(abortMsg,resourceAbort);			// Tell 'em.
+		complete = true;												// And we're done.
+	} else {																// Else..
+		sendHold();														// Hold on a bit longer.
+	}																		//
+	return false;														// Not yet.
+}
+
+
+// We're holding off a peer 'till we catch up. Each time the hold timer runs out, call
+// this. Drained down? Return true and the caller carries on. If not, hold some more. Or
+// give up, we're just too busy.
+bool xferNode::waitResume(void) {
+
+	if (!ourList->backedUp(this,true)) {						// Caught up?
+		holdCount = 0;													// Start fresh for next time.
+		lastMs = millis();											// Restart the stall clock.
+		return true;													// Carry on.
+	}																		//
+	if (holdCount>=XFER_MAX_HOLDS) {								// Been holding too long?
+		reason = busyAbort;											// Just too busy.
+		sendflowControlMsg(abortMsg,busyAbort);				// Tell 'em.
+		complete = true;												// And we're done.
+	} else {																// Else..
+		sendHold();														// Hold on a bit longer.
+	}																		//
+	return false;														// Not yet.
+}
+
+
+// Have we heard from them? If they're not in the address list, they're likely not there.
+bool xferNode::peerOnline(void) { return ourNetObj->ourAddrList.findAddr(msgAddr)!=NULL; }
+
+
+// Outgoing, we failed. If it was because they were busy or we timed out, and we have
+// retries left, we hang onto the data and back off for a bit. Each time twice as long.
+// Return true if we're going to try again. Caller sets its own waiting state.
+bool xferNode::retryLater(void) {
+
+	long	waitMs;
+	int	i;
+	
+	if (reason!=busyAbort && reason!=timoutAbort) return false;	// Only worth it for these.
+	if (tries>=retry.maxTries) return false;							// Out of tries.
+	waitMs = retry.backoffMs;												// Start here..
+	for (i=0;i<tries && waitMs<retry.maxBackoffMs;i++) {			// Double for each try so far..
+		waitMs = waitMs*2;													//
+	}																				//
+	if (waitMs>retry.maxBackoffMs) waitMs = retry.maxBackoffMs;	// Not too long.
+	tries++;																		// Count it.
+	xFerTimer.setTime(waitMs,true);										// Wait this long.
+	return true;																// And we'll try again.
+}
+
+
+// Outgoing peer to peer, we have our data and are ready to go. But if we're already
+// talking to this peer, we get in line. The list starts us when it's our turn.
+void xferNode::startOrWait(void) {
+
+	toPeer	= true;										// We're one of these.
+	peerSeq	= ourList->peerSeqNum++;				// Here's our place in line.
+	if (ourList->peerBusy(msgAddr)) {				// Someone else talking to them?
+		waitTurn = true;									// We wait.
+	} else {													// Else..
+		startXfer();										// Off we go.
+	}
+}
+
+
+// Outgoing peer to peer fill this in to send the request to send.
+void xferNode::startXfer(void) {  }
+
+
+// Someone wants to hear how this goes. Hook 'em up to us.
+void xferNode::attachHandle(xferHandle* inHandle) {
+
+	ourHandle = inHandle;
+	if (ourHandle) ourHandle->ourNode = this;
+	if (complete) finishHandle();						// Failed before we got going? They hear now.
+}
+
+
+// Outgoing, we're over. Set how it went and tell the handle right now. Not when the list
+// gets 'round to recycling us, that can be a few idle()s later.
+void xferNode::done(bool inSuccess,abortReason inReason) {
+
+	success	= inSuccess;
+	reason	= inReason;
+	complete	= true;
+	finishHandle();
+}
+
+
+// Tell the handle, if there is one, how it went. Only the once. We let go of it first.
+// Their xferDone() may well start the next send with it.
+void xferNode::finishHandle(void) {
+
+	xferHandle*	aHandle;
+	uint32_t		sent;
+	
+	if (ourHandle) {									// Someone waiting to hear how it went?
+		aHandle = ourHandle;							// Grab it..
+		ourHandle = NULL;								// It's not ours anymore.
+		sent = byteTotal;								// Bytes sent..
+		if (sent>msgSize) sent = msgSize;		// Not counting padding.
+		aHandle->tries = tries;						// How many retries it took.
+		aHandle->finish(success,reason,sent);	// Let 'em know.
+	}
+}
+
+
+// Send a clear to send with zero packets. In J1939 speak, "hold the connection open, I'm
+// not ready yet." Has to be resent every half second or they give up on us.
+void xferNode::sendHold(void) {
+
+	holding = true;													// Zero packets.
+	if (fcPDUf==ETP_FLOW_CON_PF) {								// Extended?
+		sendflowControlMsg(etpClearToSend);						// Extended clear to send.
+	} else {																// Regular..
+		sendflowControlMsg(clearToSend);							// Regular clear to send.
+	}																		//
+	holding = false;													// Back to normal.
+	holdCount++;														// Count it.
+	xFerTimer.setTime(XFER_HOLD_MS,true);						// Next one goes out when this dings.
+}
+
+
+// How much of the reassembly budget are we using?
+uint32_t xferNode::rxBytes(void) {
+
+	if (incoming && msgBuff && !complete) return msgSize;	// Our RAM, reassembling.
+	return 0;															// Sinks, outgoing, done.. Use none.
+}
+
+
+// Heard nothing in a while?
+bool xferNode::stalled(void) { return millis()-lastMs>XFER_STALL_MS; }
+
+
+// Someone more important needs our RAM. Give it up and go away.
+void xferNode::evict(void) {
+
+	if (msgBuff) {														// If we have RAM..
+		msgBuff->release();											// Let it go now. Not at cleanup.
+		msgBuff = NULL;												//
+	}																		//
+	reason = resourceAbort;											// Lost our RAM.
+	success = false;													// A fail.
+	complete = true;													// And we're done.
+}
+
+
+// Only outgoing broadcasts waiting their turn say yes to this.
+outgoingBroadcast* xferNode::queuedBAM(void) { return NULL; }
+
+
+// Are we an incoming broadcast, still running, from this address? Only one kind says yes.
+bool xferNode::bamFrom(byte srcAddr) { return false; }
+
+
+// Outgoing nodes with packets to pace override these two. How long 'till we want to send,
+// -1 for nothing to send. And do the sending.
+long xferNode::msToTx(void) { return -1; }
+
+
+void xferNode::serviceTx(void) {  }
+
+
+// Room on the bus for one of our data packets?
+bool xferNode::bwClear(void) {
+
+	bandwidthMgr*	bw;
+	
+	bw = &(ourNetObj->ourBandwidth);
+	return bw->canSend(bw->classify(dtPDUf));
+}
+
+
+// And if not, how long 'till there is?
+long xferNode::bwWait(void) {
+
+	bandwidthMgr*	bw;
+	
+	bw = &(ourNetObj->ourBandwidth);
+	return bw->msToSend(bw->classify(dtPDUf));
+}
+
+
+// Incoming, copy the data bytes of a data packet into our buffer. Or theirs. Or stream
+// them along. Bytes past the end of the message are padding and are ignored.
+void xferNode::storeData(message* inMsg) {
+
+	byte		chunk[7];
+	int		i;
+	uint32_t	offset;
+	
+	lastMs = millis();												// We heard from them.
+	offset = byteTotal;												// Where this packet's data starts.
+	i = 1;																// Data starts at byte one.
+	while(byteTotal<msgSize&&i<8) {								// While we have data to transfer and a place to store it.
+		if (sinkBuff) {												// Their buffer?
+			sinkBuff[byteTotal] = inMsg->getDataByte(i);		// Straight in.
+		} else if (ourSink) {										// Streaming?
+			chunk[i-1] = inMsg->getDataByte(i);					// Collect it.
+		} else {															// Our buffer.
+			msgBuff->setByte(byteTotal,inMsg->getDataByte(i));	// We transfer bytes.
+		}																	//
+		byteTotal++;													// Bump up the total transferred.
+		i++;																// Bump local count.
+	}																		//
+	if (ourSink && !sinkBuff && i>1) {							// Streaming and we got some?
+		ourSink->dataChunk(offset,chunk,i-1);					// Off it goes.
+	}
+}
+
+
+// Add a completed incoming msg to the list of incoming messages. We build the message
+// object right in place and hand it our data. If it all came in one chunk, it goes across
+// as a plain data block. Otherwise the message gets the chunked buffer.
+void xferNode::addMsgToQ(void) {
+
+	message	header(0);
+	msgObj*	newMsg;
+	byte*		dataPtr;
+	
+	if (ourSink) {													// Going to a sink?
+		ourSink->endXfer(true,notAbort);						// Tell 'em it's all there.
+		ourSink = NULL;											// And we're done with them.
+		return;														// Nothing gets queued.
+	}
+	header.setPGN(xferPGN);										// Set in our saved PGN.
+	header.setSourceAddr(msgAddr);							// Set in their address.
+	newMsg = new msgObj(&header);								// Make up a msgObj. No data yet.
+	if (newMsg) {													// Got one?
+		dataPtr = msgBuff->passData();						// See if it'll come out as a plain block.
+		if (dataPtr) {												// It did!
+			newMsg->acceptData(dataPtr,msgSize);			// Hand it over.
+		} else {														// Nope, chunked.
+			newMsg->attachBuff(msgBuff);						// The whole buffer goes.
+			msgBuff = NULL;										// And it's no longer ours.
+		}
+		ourNetObj->ourMsgQ.push(newMsg);						// Stuff it into the queue.
+	}
+}
+
+
+// Send data message. All the info needed to do this should be in our local globals. ETP
+// packet numbers restart at one for each window, so they pass in the window offset as
+// seqBase.
+bool xferNode::sendDataMsg(uint32_t seqBase) {
+
+	message	dataMsg;
+
+	dataMsg.setPriority(DEF_TP_PRIORITY);						// Set up the standard bits..
+	dataMsg.setR(0);													// Reserve bit.
+	dataMsg.setDP(0);													// Data page.
+	dataMsg.setPDUf(dtPDUf);										// Data xFer message. TP or ETP.
+	dataMsg.setPDUs(msgAddr);										// Broadcasting or peer to peer.
+	dataMsg.setSourceAddr(ourNetObj->getAddr());				// From us.
+	dataMsg.setDataByte(0,packNum-seqBase);					// Data packet ID.
+	packNum++;															// Next..
+	for(int i=1;i<8;i++) {											// For each byte..
+		if (byteTotal>=msgSize) {									// If we've run out of data..
+			dataMsg.setDataByte(i,0xFF);							// Data byte is flagged as 255.
+		} else {															// Else, we have data to send.
+			dataMsg.setDataByte(i,msgBuff->getByte(byteTotal++));	// Write the data byte.
+		}																	//
+	}																		//
+	ourNetObj->outgoingingMsg(&dataMsg);						// And its on it's way!
+	return byteTotal>=msgSize;										// Return if this was the last or not.
+}
+
+
+// We are either sending a oversize message or receiving one. In either case, there is an
+// initial message that starts all of this. Either and oversized message we are sending or
+// some sort of BAM message we are receiving. We use this and get the PGN so we can use
+// it later as a flow control message ID.
+void xferNode::saveFCID(message* initMsg) {
+
+	uint32_t	aPGN;
+	
+	if (initMsg) {														// Sanity, we actually got one.
+		if (initMsg->getPDUf()==FLOW_CON_PF||initMsg->getPDUf()==ETP_FLOW_CON_PF) {	// Ok, it's flow control. We grab the three bytes from here.
+			xferPGN = initMsg->getData5PGN();					// We have this handy function for that.
+		} else {															// Else its NOT a flow control. Must be from us.
+			xferPGN = initMsg->getPGN();							// Messages know how to do this for themselves.
+		}
+		aPGN	= xferPGN;												// Copy the PGN, this is going to tear things apart..
+		byte5	= aPGN & 0x000000FF;									// Grab LSB
+		aPGN	= aPGN >> 8;											// Slide over PGN.
+		byte6	= aPGN & 0x000000FF;									// Grab MDB
+		aPGN	= aPGN >> 8;											// Slide over PGN.
+		byte7	= aPGN & 0x000000FF;									// Grab MSB
+	} else {																// Else? We're getting nutty parameters. Pull the plug.
+		success = false;												// This is NOT a success.
+		complete = true;												// We're done.
+		reason = notAbort;											// The other side did not abort this. The powers-that-be went bananas.
+	}
+}
+	
+	
+bool  xferNode::checkFCID(message* inMsg)	{
+
+	if (inMsg) {
+		
+		if (byte5 == inMsg->getDataByte(5)) {
+			if (byte6 == inMsg->getDataByte(6)) {
+				if (byte7 == inMsg->getDataByte(7)) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+	
+
+// Send flowControl message.
+void xferNode::sendflowControlMsg(flowContType msgType,abortReason reason) {
+
+	message	flowContMsg;
+	uint16_t	aWord;
+	uint8_t	aByte;
+	
 	flowContMsg.setPriority(7);								// Set up the standard bits..
 	flowContMsg.setR(0);											// Reserve bit.
 	flowContMsg.setDP(0);										// Data page.
-	flowContMsg.setPDUf(FLOW_CON_PF);						// Yes, an FC message.
+	flowContMsg.setPDUf(fcPDUf);								// Yes, an FC message. TP or ETP.
 	flowContMsg.setPDUs(msgAddr);								// FCs are for doing peer to peer. OR.. BAM messages.
 	flowContMsg.setSourceAddr(ourNetObj->getAddr());	// From us.
 	flowContMsg.setDataByte(0,(int)msgType);				// Data section, first is a constant.
@@ -1195,8 +2260,13 @@ void xferNode::sendflowControlMsg(flowContType msgType,abortReason reason) {
 			flowContMsg.setDataByte(4,0xFF);					// See BYTE 4 note below.
 		break;						
 		case clearToSend	:
-			flowContMsg.setDataByte(1,msgPacks);			// Set in num message packets.
-			flowContMsg.setDataByte(2,packNum);				// The expected packet number. (base 1)
+			if (holding) {											// If we're holding them off..
+				flowContMsg.setDataByte(1,0);					// Zero packets. "Hang on."
+				flowContMsg.setDataByte(2,0xFF);				// And no packet number.
+			} else {													// Else, normal..
+				flowContMsg.setDataByte(1,msgPacks);		// Set in num message packets.
+				flowContMsg.setDataByte(2,packNum);			// The expected packet number. (base 1)
+			}
 			flowContMsg.setDataByte(3,0xFF);					// Fill with 0xFF. Ok..
 			flowContMsg.setDataByte(4,0xFF);					// Same here.
 		break;	
@@ -1210,6 +2280,26 @@ void xferNode::sendflowControlMsg(flowContType msgType,abortReason reason) {
 			flowContMsg.setDataByte(3,msgPacks);			// Set in num message packets.
 			flowContMsg.setDataByte(4,0xFF);					// Fill with 0xFF. Ok..
 		break;	
+		case etpReqToSend	:										// Extended, the size gets four bytes.
+		case etpEndOfMsg	:										// Same for the end of message.
+			flowContMsg.setULongInData(1,msgSize);			// Data index 1..4.
+		break;
+		case etpClearToSend	:
+			if (holding) {											// If we're holding them off..
+				flowContMsg.setDataByte(1,0);					// Zero packets. "Hang on."
+			} else {													// Else..
+				flowContMsg.setDataByte(1,winPacks);		// How many packets they can send this time.
+			}
+			flowContMsg.setDataByte(2,packNum & 0xFF);	// The expected packet number. (base 1, 24 bits)
+			flowContMsg.setDataByte(3,(packNum>>8) & 0xFF);
+			flowContMsg.setDataByte(4,(packNum>>16) & 0xFF);
+		break;
+		case etpDataOffset	:
+			flowContMsg.setDataByte(1,winPacks);			// How many packets are coming.
+			flowContMsg.setDataByte(2,winStart & 0xFF);	// How many came before them. (24 bits)
+			flowContMsg.setDataByte(3,(winStart>>8) & 0xFF);
+			flowContMsg.setDataByte(4,(winStart>>16) & 0xFF);
+		break;
 		case abortMsg		:
 			aByte = (int)reason;									// Read the abort reason as an integer.
 			flowContMsg.setDataByte(1,aByte);				// Wants the abort reason.
@@ -1218,604 +2308,2540 @@ void xferNode::sendflowControlMsg(flowContType msgType,abortReason reason) {
 			flowContMsg.setDataByte(4,0xFF);					// There ya' go..
 		break;
 	}
-	flowContMsg.setDataByte(5,byte5);						//	Stuff pre-calculated PGN bytes in place.
-	flowContMsg.setDataByte(6,byte6);						// 
-	flowContMsg.setDataByte(7,byte7);						//
-	ourNetObj->outgoingingMsg(&flowContMsg);				// Off it goes!
+	flowContMsg.setDataByte(5,byte5);						//	Stuff pre-calculated PGN bytes in place.
+	flowContMsg.setDataByte(6,byte6);						// 
+	flowContMsg.setDataByte(7,byte7);						//
+	ourNetObj->outgoingingMsg(&flowContMsg);				// Off it goes!
+}
+
+// BYTE 4 : In a broadcast this is supposed to be set to 0xFF meaning unlimited amount of
+// packets. But in response to a Clear-To-Send from a peer? It is to be set to the max
+// number of packets to be sent. Or 0xFF for unlimited.. So what is this unlimited thing
+// saying? Are we establishing a data stream? I think not! This is nonsense. We already,
+// with BYTE 3, established the number of packets to be sent.
+//
+// Hence: I'll set it to 0xFF (unlimited) for now.
+
+
+
+//				          -----    outgoingBroadcast    -----
+
+
+// We grab the data and get in line. The list's scheduler will call startBAM() when it's
+// our turn.
+outgoingBroadcast::outgoingBroadcast(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+	
+	success = false;								// We assume this will fail. Such a bad attitude.
+	complete = true;								// We are done.
+	reason = noReason;							// And it's because WE did something wrong.
+	ourState = bamQueued;						// Nothing's been sent.
+	bamPrio = DEF_TP_PRIORITY;					// Until we see the message.
+	bamSeq = 0;										//
+	if (inMsg && inNetObj) {					// OK. As always, check sanity..
+		msgSize = inMsg->getNumBytes();		// Save off the size. (used later)
+		if (msgSize>8 && msgSize<=TP_MAX_BYTES) {	// If its's too big, but not too too big..
+			saveFCID(inMsg);						// Save off the PGN for later.
+			if (takeData(inMsg)) {				// Hands over the actual data to us. (Yes messages can do this.)
+				msgPacks = msgSize/7;			// Seven goes into num bytes.?.
+				if (msgSize%7) {					//	We got leftovers?
+					 msgPacks++;					// Then add one.
+				}										// (msgPack is used later.)
+				msgAddr = GLOBAL_ADDR;			// Send to.. Everyone?
+				bamPrio = inMsg->getPriority();	// How important is this?
+				bamSeq = inList->bamSeqNum++;	// And where are we in line?
+				complete = false;					// Successfully queued. So, not complete.
+			} else {
+				reason = resourceAbort;			// No RAM to hold it.
+			}
+		}
+	}			
+}
+
+
+// The base class recycles the data buffer. If we were the one sending, let the list know
+// we're gone.
+outgoingBroadcast::~outgoingBroadcast(void) {
+
+	if (ourList->activeBAM==this) {
+		ourList->activeBAM = NULL;
+	}
+}
+
+
+// Are we waiting our turn? Then here we are.
+outgoingBroadcast* outgoingBroadcast::queuedBAM(void) {
+
+	if (!complete && ourState==bamQueued) return this;
+	return NULL;
+}
+
+
+// Our turn. Announce what's coming.
+void outgoingBroadcast::startBAM(void) {
+
+	sendflowControlMsg(BAM);					// Send a BAM message.
+	ourState = bamSending;						// From now on, we're sending data.
+}
+
+
+// Should we go before this other one? More important first, then first come.
+bool outgoingBroadcast::goesBefore(outgoingBroadcast* other) {
+
+	if (bamPrio!=other->bamPrio) return bamPrio<other->bamPrio;		// Lower number is more important.
+	return (int32_t)(bamSeq-other->bamSeq)<0;								// Then who got here first. (Survives wrap)
+}
+
+
+// Broadcasts do all their work blindly off the list's shared clock. In serviceTx().
+void outgoingBroadcast::idleTime(void) {  }
+
+
+// If it's our turn and the shared clock says a packet's due, send it.
+void outgoingBroadcast::serviceTx(void) {
+	
+	bool	dataDone;
+	
+	if (!complete && ourState==bamSending) {	// If we're currently running..
+		if (ourList->bamPacer.isDue() && bwClear()) {	// If the shared clock says go, and the bus has room..
+			dataDone = sendDataMsg();				// Pack up and send a data message.
+			ourList->bamPacer.markSent(ourList->getTxGap(xferPGN,true),ourList->getMinGap(true));
+			if (dataDone) {							// If that was the last data packet..
+				done(true,reason);					// Then, as far as we know, this was a success.
+			}
+		}
+	}
+}
+
+
+
+//				          -----    outgoingPeerToPeer    -----
+
+
+// The outside world thinks this message should be broken into packets to be send out.
+// We'll have a look and see if this is the case.
+outgoingPeerToPeer::outgoingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+
+	complete = true;											// Assume we are done here.
+	success = false;											// Assume failure.
+	ourState = waitToSend;									// Something sane 'till we start.
+	if (inMsg) {												// Always check sanity..
+		msgSize = inMsg->getNumBytes();					// Save off the size. Just in case..
+		if (msgSize>8 && msgSize<=TP_MAX_BYTES) {		// If its's too big, but not too too big..
+			if (!inMsg->isBroadcast()) {					// If it's NOT to everyone.. (Peer to peer)
+				saveFCID(inMsg);								// Save off the PGN for later.
+				msgAddr = inMsg->getPDUs();				// Peer to peer to.. 
+				retry = *(inList->getRetry(xferPGN));	// Our copy of how to retry.
+				if (retry.needPeer && !peerOnline()) {	// If they're not out there..
+					reason = noPeerAbort;					// Don't waste the time. Fail now.
+				} else if (takeData(inMsg)) {				// Hand over the actual data to us. (messages can do this, very scary.)
+					msgPacks = msgSize/7;					// Seven goes into num bytes?.
+					if (msgSize%7) {							//	We got leftovers?
+						 msgPacks++;							// Then add one.
+					}												// 
+					startOrWait();								// Send the request to send. Or get in line for our peer.
+					complete = false;							// Ok. Meets all criteria. Do not kill us yet, we're still running.
+				} else {
+					reason = resourceAbort;					// No RAM to hold it.
+				}
+			}
+		}	
+	}			
+}
+	
+
+// The base class recycles the data buffer.
+outgoingPeerToPeer::~outgoingPeerToPeer(void) {  }
+
+
+// From the top. Ask to send. We still have all the data, so retries start here too.
+void outgoingPeerToPeer::startXfer(void) {
+
+	packNum = 1;									// Start at the first packet.
+	byteTotal = 0;									// None sent.
+	reason = noReason;							// Nothing's gone wrong. This time.
+	sendflowControlMsg(reqToSend);			// Send a reqToSend message.
+	ourState = waitToSend;						// We don't send another 'till they say it's ok.
+	xFerTimer.setTime(TR_MS,true);			// We allow this much time for a clear to send to come in.
+}
+
+
+// Messages will be passed in for us to peruse. We'll filter out ones specifically for
+// ourselves and deal with them here. We'll return true if we dealt with the message.
+// Actually the only things we respond to are flow control messages. Anything else we'll
+// ignore.
+bool outgoingPeerToPeer::handleMsg(message* inMsg) {
+
+	bool 	handled;
+	
+	handled = false;											// We've done nothing yet.
+	if (isPeerMsg(inMsg)) {									// Lets see if it's real and one we need to deal with.
+		if (ourState==waitToRetry) return true;		// Leftovers from the last try. Ignore 'em.
+		switch(inMsg->getDataByte(0)) {					// Lets take a look at the control byte..
+			case  clearToSend	:								// We got a clear to send message.
+				if (ourState==waitToSend) {				// If we were waiting for a clear to send..
+					if (inMsg->getDataByte(1)==0) {		// If flagged "Need more time"..
+						xFerTimer.setTime(TH_MS,true);	// Bump up the allowed time to this much. For clear or ACK.
+					} else {										// Else it's a normal "clear to send".
+						ourState = sendingData;				// We owe them a data packet.
+						serviceTx();							// If there's bandwidth, it goes now.
+					}												//
+				} else if (ourState==waitForACK) {		// If we were waiting for an ACK.. {
+					if (inMsg->getDataByte(1)==0) {		// If flagged "Need more time"..
+						xFerTimer.setTime(TH_MS,true);	// Bump up the allowed time to this much. For clear or ACK.
+					} else {													// Else this is messed up. We bail.
+						done(false,notAbort);							// Crazy sauce stops the game. We got nonsense, not an abort.
+					}															//
+				}																//
+			break;															// That should cover all those cases.
+			case  endOfMsg		:											// We got an end of message.
+				done(ourState==waitForACK,reason);					// If we were waiting for it, success! In every case we are completely done.
+			break;															// And that's it.
+			case  abortMsg		:											// Got an abort?!
+				reason = valueToReason(inMsg->getDataByte(1));	// Ask them why?
+				if (retryLater()) {										// If it's worth another go..
+					ourState = waitToRetry;								// Back off for a bit.
+				} else {														// Else..
+					done(false,reason);									// We are done.
+				}
+			break;															// Sigh, we failed. (Maybe)
+			default				:											// If we hit a default we are seriously messed up.
+				done(false,notAbort);									// We didn't get an abort. We got nonsense.
+			break;															// Maybe we should take up knitting?
+		}																		//
+		handled = true;													// In all cases, it was our message. So we handled it.
+	} 																			//
+	return handled;														// We return our result.
+}
+						
+					
+
+	
+// During break time, we'll check to see if the timer's run out. If so? The message failed
+// to complete. Unless we were backing off. Then it's time to try again.
+void outgoingPeerToPeer::idleTime(void) {
+	
+	if (!complete && !waitTurn && ourState!=sendingData) {	// If we're still running, not in line, and not holding a packet..
+		if (xFerTimer.ding()) {							// If the timer ran out..
+			if (ourState==waitToRetry) {				// Done backing off?
+				startXfer();								// Go again.
+			} else {											// Else there was no response..
+				reason = timoutAbort;					// We have a timeout failure.
+				if (retryLater()) {						// Worth another go?
+					sendflowControlMsg(abortMsg,timoutAbort);	// Close this one out on their end.
+					ourState = waitToRetry;				// And back off.
+				} else {										// Else..
+					done(false,reason);					// I have failed! Kill me now!
+				}
+			}
+		}
+	}
+}
+
+
+
+// Holding a data packet? It goes as soon as there's bandwidth for it.
+long outgoingPeerToPeer::msToTx(void) {
+
+	if (complete || ourState!=sendingData) return -1;	// Nothing to send.
+	return 0;														// The list adds in the bandwidth wait.
+}
+
+
+// Send the data packet we owe, if the bus has room for it.
+void outgoingPeerToPeer::serviceTx(void) {
+
+	bool	dataDone;
+	
+	if (complete || ourState!=sendingData) return;		// Nothing to send.
+	if (!bwClear()) return;										// Over our share. Wait.
+	dataDone = sendDataMsg();									// We send a data packet.
+	if (dataDone) {												// If that was the last data packet..
+		ourState = waitForACK;									// We're now waiting for an ACK.
+	} else {															// Else..
+		ourState = waitToSend;									// Wait for the next clear to send.
+	}																	//
+	xFerTimer.setTime(T3_MS,true);							// We allow this much time for clear or ACK
+}
+
+
+
+//				          -----    incomingBroadcast    -----
+
+
+// We are being created to handle an incoming broadcast. Let's get to it.
+incomingBroadcast::incomingBroadcast(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+
+	msgSize	= packU16(inMsg->getDataByte(2),inMsg->getDataByte(1));	// Grab the number of bytes.
+	saveFCID(inMsg);																	// Save off the PGN for later.
+	msgAddr = inMsg->getSourceAddr();											// Grab source address.
+	if (getRoom()==roomOK) {														// If there's room for it. (Can't ask a broadcast to wait.)
+		msgPacks = inMsg->getDataByte(3);										// Grab the number of packets.
+		xFerTimer.setTime(BCAST_T1_MS);											// We start the timeout timer.
+		complete = false;																// Clear the complete flag, were running!
+	} else {																				// Oh ohh, ran outta' RAM.
+		reason = resourceAbort;														// Failed to get the RAM.
+		success = false;																// So we failed.
+		complete = true;																// And we're done.
+	}
+}																					
+
+	
+// The base class recycles the data buffer. So nothing to do here.
+incomingBroadcast::~incomingBroadcast(void) { }
+
+
+// Broadcasts run completely on timers and there is no way to control them from this end.
+bool incomingBroadcast::handleMsg(message* inMsg) {
+
+	bool		handled;
+	
+	handled = false;														// Not handled anything yet.
+	if (isOurMsg(inMsg)) {												// If it's from our guy.															
+		storeData(inMsg);													// Fine! We'll take it.
+		packNum++;															// Bump up our packet ID num.
+		if (byteTotal==msgSize) {										// If we got ALL the bytes?
+			addMsgToQ();													// Hand what we built to the queue.
+			success = true;												// A success!
+			complete = true;												// Call for our recycling, we're done!
+		} else {																// Else there's more? Of course there's more!
+			xFerTimer.start();											// Restart the timeout timer.
+		}																		//
+		handled = true;													// Hey, we we handled that one!
+	}																			//
+	return handled;														// Wasn't what we were looking for. Not handled.
+}
+
+
+// If our timer ever expires we assume the sending node gave up.
+void incomingBroadcast::idleTime(void) {
+
+	if (!complete) {					// If we're still running..
+		if (xFerTimer.ding()) {		// And our timeout timer expires?
+			reason = timoutAbort;	// Then we ran outta' time!
+			complete = true;			// Call for our recycling, we're done!
+		}
+	}
+}
+
+
+// That's us if we're still going and they're who we're listening to.
+bool incomingBroadcast::bamFrom(byte srcAddr) { return !complete && msgAddr==srcAddr; }
+
+
+
+//				         -----    incomingPeerToPeer    -----
+
+
+incomingPeerToPeer::incomingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+	
+	if (inMsg) {																					// Quick sanity.
+		if (inMsg->getPDUf()==SEND_REQ) {													// Peer to peer, we only have the PDUf to go on.
+			if (inMsg->getPDUs()==inNetObj->getAddr()) {									// It's ours.
+				msgSize	= packU16(inMsg->getDataByte(2),inMsg->getDataByte(1));	// Grab the number of bytes.
+				saveFCID(inMsg);																	// Grab PGN to be used later.
+				msgAddr = inMsg->getSourceAddr();											// Grab return addr.
+				msgPacks = inMsg->getDataByte(3);											// Grab the number of packets.
+				switch(getRoom()) {																// See if we have room for it.
+					case roomOK		:																// We do.
+						if (ourList->backedUp(this,false)) {									// But we're swamped..
+							sendHold();																// Ask them to hang on.
+							ourState = waitToResume;											// 'Till we catch up.
+						} else {																		// Else..
+							sendflowControlMsg(clearToSend);									// Tell 'em it's ok, send the data.
+							xFerTimer.setTime(T2_MS);											// We start the timeout timer.
+							ourState = waitForData;												// Data should be coming.
+						}																				//
+						complete = false;															// Clear the complete flag. We're running!
+					break;																			//
+					case roomWait	:																// Not yet..
+						sendHold();																	// Ask them to hang on.
+						ourState = waitForRoom;													// And we wait for room.
+						complete = false;															// But we're running.
+					break;																			//
+					default			:																// Else we couldn't get the RAM?
+						sendflowControlMsg(abortMsg,resourceAbort);						// Send an abort message.
+						reason = resourceAbort;													// Note we ran outta' RAM.
+						complete = true;															// And tell 'em to dump us off the list. Ain't going to work.
+					break;
+				}
+			}
+		}
+	}
+}
+
+	
+
+// We attempted to allocate the message buffer. If we failed at some point it might be
+// laying about wasted RAM. The base class recycles it if so.
+incomingPeerToPeer::~incomingPeerToPeer(void) {  }
+
+
+// We can get data packets or flow control packets.
+bool incomingPeerToPeer::handleMsg(message* inMsg) {
+
+	bool		handled;
+	
+	handled = false;															// Well, we haven't handled anything yet.
+	if (isPeerMsg(inMsg)) {													// Is this message ours ans in good shape?																			
+		if (inMsg->getPDUf()==DATA_XFER_PF) {							// If it's a data packet..
+			if (ourState!=waitForData) return true;					// We asked them to hold. Ignore it.
+			storeData(inMsg);													// Fine! We'll take it.
+			packNum++;															// Bump up our packet ID num.
+			if (byteTotal==msgSize) {										// If we got 'em all..
+				addMsgToQ();													// Hand what we built to the queue.
+				success = true;												// A success!
+				complete = true;												// Call for our recycling, we're done!
+				sendflowControlMsg(endOfMsg);								// Tell 'em we got it all.
+			} else if (byteTotal<msgSize) {								// Else there's more coming..
+				if (ourList->backedUp(this,false)) {					// But we're swamped..
+					sendHold();													// Ask them to hang on.
+					ourState = waitToResume;								// 'Till we catch up.
+				} else {															// Else..
+					sendflowControlMsg(clearToSend);						// Tell 'em to send more.
+					xFerTimer.setTime(T2_MS);								// We start the timeout timer.
+				}
+			} else {
+				reason = notAbort;											// Missed the ending somehow.
+				success = false;												// A fail.
+				complete = true;												// We missed the data count. Abort!!
+				sendflowControlMsg(abortMsg);								// Tell 'em
+			}													
+			handled = true;													// We handled this message.
+		} else if (inMsg->getPDUf()==FLOW_CON_PF) {					// Or, if it's a flow control msg..
+			
+			switch(inMsg->getDataByte(0)) {								// Let's see what they sent us.
+				case reqToSend		:											// Umm, we're receiving, not sending.
+				case clearToSend	:											// Same as above.
+				case BAM				:											// Whoa! This is peer to peer..
+					reason = notAbort;										// We didn't get an abort. They went nuts!
+					success = false;											// A fail.
+					complete = true;											// Each case is crazy sauce. Pull the plug!
+				break;															// Enough!
+				case abortMsg		:											// Abort is valid.
+					reason = valueToReason(inMsg->getDataByte(1));	// We'll save their reason.
+					success = false;											// A fail.
+					complete = true;											// And we're done.
+				break;															// Jump out.
+				default				:											// We got something else?!
+					reason = notAbort;										// We didn't get an abort, they sent gibberish.
+					success = false;											// A fail.
+					complete = true;											// Again it's crazy sauce. Pull the plug!
+				break;															//
+			}																		//
+			handled = true;													// We handled this message.				   
+		}
+	}		
+	return handled;
+}
+
+
+// Idle in this case is basically a deadman switch. If the timer expires, the connection
+// was lost. Unless we're holding them off waiting for room. Then it's time to check again.
+void incomingPeerToPeer::idleTime(void) {
+
+	if (!complete && xFerTimer.ding()) {			// If the timer expires while still working..
+		if (ourState==waitForRoom) {					// Holding?
+			if (waitRoom()) {								// Room now?
+				sendflowControlMsg(clearToSend);		// Tell 'em it's ok, send the data.
+				xFerTimer.setTime(T2_MS);				// We start the timeout timer.
+				ourState = waitForData;					// Data should be coming.
+			}
+		} else if (ourState==waitToResume) {		// Holding 'till we catch up?
+			if (waitResume()) {							// Caught up?
+				sendflowControlMsg(clearToSend);		// Tell 'em to send more.
+				xFerTimer.setTime(T2_MS);				// We start the timeout timer.
+				ourState = waitForData;					// Data should be coming.
+			}
+		} else {
+			reason = timoutAbort;
+			complete = true;								// Give up. The other side dropped connection.
+		}
+	}
+}
+
+
+// Lost our RAM to someone more important. Tell our peer.
+void incomingPeerToPeer::evict(void) {
+
+	xferNode::evict();									// Let it go.
+	sendflowControlMsg(abortMsg,resourceAbort);	// And say why.
+}
+
+
+
+//				         -----    outgoingExtended    -----
+
+
+// Same as outgoingPeerToPeer, only bigger. The outside world has a message too big for
+// the regular transport protocol. If it's peer to peer, we can do it.
+outgoingExtended::outgoingExtended(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+
+	fcPDUf = ETP_FLOW_CON_PF;									// We talk extended.
+	dtPDUf = ETP_DATA_XFER_PF;									//
+	ourState = waitToSend;										// Something sane 'till we start.
+	if (inMsg) {													// Always check sanity..
+		msgSize = inMsg->getNumBytes();						// Save off the size.
+		if (msgSize>TP_MAX_BYTES && msgSize<=ETP_MAX_BYTES) {	// If it's an extended sized message..
+			if (!inMsg->isBroadcast()) {						// And it's NOT to everyone.. (No such thing as an ETP broadcast)
+				saveFCID(inMsg);									// Save off the PGN for later.
+				msgAddr = inMsg->getPDUs();					// Peer to peer to..
+				retry = *(inList->getRetry(xferPGN));		// Our copy of how to retry.
+				if (retry.needPeer && !peerOnline()) {		// If they're not out there..
+					reason = noPeerAbort;						// Don't waste the time. Fail now.
+				} else if (takeData(inMsg)) {					// Take over the actual data.
+					msgPacks = msgSize/7;						// Seven goes into num bytes?.
+					if (msgSize%7) {								//	We got leftovers?
+						 msgPacks++;								// Then add one.
+					}													//
+					startOrWait();									// Send the request to send. Or get in line.
+					complete = false;								// We're running.
+				} else {
+					reason = resourceAbort;						// No RAM to hold it.
+				}
+			}
+		}
+	}
+}
+
+
+// The base class recycles the data buffer.
+outgoingExtended::~outgoingExtended(void) {  }
+
+
+// From the top. Ask to send. Retries start here too.
+void outgoingExtended::startXfer(void) {
+
+	packNum = 1;									// Start at the first packet.
+	byteTotal = 0;									// None sent.
+	winStart = 0;									// No windows yet.
+	winPacks = 0;									//
+	reason = noReason;							// Nothing's gone wrong. This time.
+	sendflowControlMsg(etpReqToSend);		// Send an extended reqToSend message.
+	ourState = waitToSend;						// Now we wait for a clear to send.
+	xFerTimer.setTime(TR_MS,true);			// We allow this much time for it to come in.
+}
+
+
+// Flow control from our peer. Clear to sends tell us where to start and how many to
+// send. We answer each with a data packet offset, then pump the window out in idleTime().
+bool outgoingExtended::handleMsg(message* inMsg) {
+
+	uint32_t	nextPack;
+	
+	if (!isPeerMsg(inMsg)) return false;						// Not ours? Not handled.
+	if (inMsg->getPDUf()!=fcPDUf) return true;				// Data packets coming at us? Ours, but makes no sense. Ignore it.
+	if (ourState==waitToRetry) return true;					// Leftovers from the last try. Ignore 'em.
+	switch(inMsg->getDataByte(0)) {								// Lets take a look at the control byte..
+		case etpClearToSend	:										// Clear to send.
+			if (inMsg->getDataByte(1)==0) {						// If flagged "Need more time"..
+				xFerTimer.setTime(TH_MS,true);					// Bump up the allowed time.
+				break;													// And wait.
+			}																//
+			nextPack = packU32(0,inMsg->getDataByte(4),inMsg->getDataByte(3),inMsg->getDataByte(2));	// Where do they want us to start?
+			if (nextPack<1 || nextPack>msgPacks) {				// If that's nonsense..
+				sendflowControlMsg(abortMsg,notAbort);			// Tell 'em.
+				done(false,notAbort);								// Nonsense. We're done.
+				break;													//
+			}																//
+			winPacks = inMsg->getDataByte(1);					// How many they'll take.
+			if (winPacks>msgPacks-nextPack+1) {					// Don't send past the end.
+				winPacks = msgPacks-nextPack+1;					//
+			}																//
+			packNum = nextPack;										// They may be asking for a resend. That's fine.
+			winStart = nextPack-1;									// The offset for this window.
+			byteTotal = winStart*7;									// Where that is in the data.
+			sendflowControlMsg(etpDataOffset);					// Tell 'em what's coming.
+			pacer.reset();												// Fresh window, first packet can go now.
+			ourState = sendingData;									// And start pumping.
+		break;
+		case etpEndOfMsg		:										// End of message ACK.
+			done(ourState==waitForACK,reason);					// If we were waiting for it, we did it! Either way, we're done.
+		break;
+		case abortMsg			:										// Got an abort.
+			reason = valueToReason(inMsg->getDataByte(1));	// Ask them why?
+			if (retryLater()) {										// If it's worth another go..
+				ourState = waitToRetry;								// Back off for a bit.
+			} else {														// Else..
+				done(false,reason);									// We're done.
+			}
+		break;
+		default					:										// Anything else is nonsense.
+			done(false,notAbort);									// We didn't get an abort. We got nonsense.
+		break;
+	}
+	return true;
+}
+
+
+// While sending a window, serviceTx() pushes out the packets. Otherwise we watch the clock.
+void outgoingExtended::idleTime(void) {
+
+	if (complete || waitTurn) return;							// Done, or in line? Nothing to do.
+	if (ourState!=sendingData && xFerTimer.ding()) {		// Waiting, and the timer ran out..
+		if (ourState==waitToRetry) {								// Done backing off?
+			startXfer();												// Go again.
+			return;														// That's it for now.
+		}																	//
+		reason = timoutAbort;										// We have a timeout failure.
+		sendflowControlMsg(abortMsg,timoutAbort);				// Tell 'em we're giving up.
+		if (retryLater()) {											// Worth another go?
+			ourState = waitToRetry;									// Back off.
+		} else {															// Else..
+			done(false,reason);										// Done.
+		}
+	}
+}
+
+
+// Sending a window? Then it's whenever the pacer says.
+long outgoingExtended::msToTx(void) {
+
+	if (complete || ourState!=sendingData) return -1;	// Nothing to send.
+	return pacer.msToGo();										// This long.
+}
+
+
+// Push out a window packet when it's due.
+void outgoingExtended::serviceTx(void) {
+
+	if (complete || ourState!=sendingData) return;			// Nothing to send.
+	if (!pacer.isDue()) return;									// Not yet.
+	if (!bwClear()) return;											// Over our share of the bus. Wait.
+	sendDataMsg(winStart);											// Send a packet. Numbers start at one each window.
+	pacer.markSent(ourList->getTxGap(xferPGN,false),ourList->getMinGap(false));
+	if (packNum>winStart+winPacks) {								// If that was the end of the window..
+		if (byteTotal>=msgSize) {									// And the end of the data..
+			ourState = waitForACK;									// We wait for the ACK.
+		} else {															// Else there's more..
+			ourState = waitToSend;									// We wait for the next clear to send.
+		}																	//
+		xFerTimer.setTime(T3_MS,true);							// Either way, this is how long we wait.
+	}
+}
+
+
+
+//				         -----    incomingExtended    -----
+
+
+// Someone wants to send us something big. Grab the RAM, chunked, and send the first clear
+// to send.
+incomingExtended::incomingExtended(message* inMsg,netObj* inNetObj,xferList* inList)
+	: xferNode(inNetObj,inList) {
+
+	fcPDUf = ETP_FLOW_CON_PF;																	// We talk extended.
+	dtPDUf = ETP_DATA_XFER_PF;																	//
+	if (inMsg) {																					// Quick sanity.
+		saveFCID(inMsg);																			// Grab PGN to be used later.
+		msgAddr	= inMsg->getSourceAddr();													// Grab return addr.
+		msgSize	= inMsg->getULongFromData(1);												// Grab the number of bytes. (Four of 'em)
+		msgPacks	= msgSize/7;																	// Work out the number of packets.
+		if (msgSize%7) {																			// Leftovers?
+			msgPacks++;																				// Add one.
+		}																								//
+		if (msgSize>0 && msgSize<=ETP_MAX_BYTES) {												// If it's sane..
+			switch(getRoom()) {																		// See if we have room for it.
+				case roomOK		:																		// We do.
+					if (ourList->backedUp(this,false)) {										// But we're swamped..
+						sendHold();																		// Ask them to hang on.
+						ourState = waitToResume;													// 'Till we catch up.
+					} else {																				// Else..
+						sendWindow();																	// Tell 'em it's ok, send the data.
+					}																						//
+					complete = false;																	// We're running!
+				break;																					//
+				case roomWait	:																		// Not yet..
+					sendHold();																			// Ask them to hang on.
+					ourState = waitForRoom;															// And we wait for room.
+					complete = false;																	// But we're running.
+				break;																					//
+				default			:																		// Else we couldn't get the RAM?
+					sendflowControlMsg(abortMsg,resourceAbort);								// Send an abort message.
+					reason = resourceAbort;															// Note we ran outta' RAM.
+				break;
+			}
+		} else {																						// Else, nonsense size.
+			sendflowControlMsg(abortMsg,resourceAbort);									// Send an abort message.
+			reason = resourceAbort;																// Can't do it.
+		}
+	}
+}
+
+
+// The base class recycles the data buffer.
+incomingExtended::~incomingExtended(void) {  }
+
+
+// Ask for the next window of packets, starting at packNum.
+void incomingExtended::sendWindow(void) {
+
+	winPacks = ETP_WIN_PACKS;									// What we'd like.
+	if (winPacks>msgPacks-packNum+1) {						// But not past the end.
+		winPacks = msgPacks-packNum+1;						//
+	}																	//
+	byteTotal = (packNum-1)*7;									// Where this window lands in the data.
+	sendflowControlMsg(etpClearToSend);						// Send it.
+	ourState = waitForDPO;										// The offset message should come first.
+	xFerTimer.setTime(T2_MS,true);							// This long.
+}
+
+
+// Offsets, data packets and the odd abort.
+bool incomingExtended::handleMsg(message* inMsg) {
+
+	if (!isPeerMsg(inMsg)) return false;											// Not ours? Not handled.
+	if (inMsg->getPDUf()==fcPDUf) {													// Flow control..
+		switch(inMsg->getDataByte(0)) {
+			case etpDataOffset	:														// The offset for the coming window.
+				winStart = packU32(0,inMsg->getDataByte(4),inMsg->getDataByte(3),inMsg->getDataByte(2));
+				if (winStart!=packNum-1 || inMsg->getDataByte(1)>winPacks) {	// Not what we asked for?
+					sendWindow();															// Ask again.
+				} else {																		// Else, looks good.
+					winPacks = inMsg->getDataByte(1);								// This many are coming.
+					ourState = waitForData;												// Wait for them.
+					xFerTimer.setTime(T1_MS,true);									// Not forever.
+				}
+			break;
+			case abortMsg			:														// Abort is valid.
+				reason = valueToReason(inMsg->getDataByte(1));					// We'll save their reason.
+				complete = true;															// And we're done.
+			break;
+			default					:														// Anything else is crazy sauce.
+				reason = notAbort;														// They went nuts.
+				complete = true;															// Pull the plug.
+			break;
+		}
+	} else if (ourState==waitForData) {												// Data packet, and we want one.. (Never while waiting for room.)
+		if (inMsg->getDataByte(0)==packNum-winStart) {							// If it's the one we expect..
+			storeData(inMsg);																// Store it.
+			packNum++;																		// Next!
+			if (byteTotal>=msgSize) {													// Got it all?
+				addMsgToQ();																// Hand it off.
+				sendflowControlMsg(etpEndOfMsg);										// Tell 'em we got it.
+				success = true;															// A success!
+				complete = true;															// We're done.
+			} else if (packNum>winStart+winPacks) {								// End of this window?
+				if (ourList->backedUp(this,false)) {									// But we're swamped..
+					sendHold();																// Ask them to hang on.
+					ourState = waitToResume;											// 'Till we catch up.
+				} else {																		// Else..
+					sendWindow();															// Ask for more.
+				}
+			} else {																			// Else, more of this window coming.
+				xFerTimer.setTime(T1_MS,true);										// Restart the clock.
+			}
+		} else {																				// Lost one somewhere..
+			sendWindow();																	// Ask them to resend from where we are.
+		}
+	}
+	return true;
+}
+
+
+// Deadman switch. If we hear nothing for too long, we give up and say so. Unless we're
+// holding them off waiting for room. Then it's time to check again.
+void incomingExtended::idleTime(void) {
+
+	if (!complete && xFerTimer.ding()) {				// If the timer expires while still working..
+		if (ourState==waitForRoom) {						// Holding?
+			if (waitRoom()) {									// Room now?
+				sendWindow();									// Ask for the first window.
+			}
+		} else if (ourState==waitToResume) {			// Holding 'till we catch up?
+			if (waitResume()) {								// Caught up?
+				sendWindow();									// Ask for the next window.
+			}
+		} else {
+			reason = timoutAbort;							// Timeout.
+			sendflowControlMsg(abortMsg,timoutAbort);	// Tell 'em.
+			complete = true;									// Give up.
+		}
+	}
+}
+
+
+// Lost our RAM to someone more important. Tell our peer.
+void incomingExtended::evict(void) {
+
+	xferNode::evict();									// Let it go.
+	sendflowControlMsg(abortMsg,resourceAbort);	// And say why.
+}
+
+
+
+//				            -----    xferSink    -----
+
+
+xferSink::xferSink(uint32_t inPGN)
+	: linkListObj() { sinkPGN = inPGN; }
+
+
+xferSink::~xferSink(void) {  }
+
+
+// By default, if you're here for this PGN, you want it.
+bool xferSink::beginXfer(byte srcAddr,uint32_t numBytes) { return true; }
+
+
+// By default, stream it.
+byte* xferSink::getBuffer(uint32_t numBytes) { return NULL; }
+
+
+// Fill these in to do something useful.
+void xferSink::dataChunk(uint32_t offset,byte* data,int numBytes) {  }
+
+
+void xferSink::endXfer(bool success,abortReason reason) {  }
+
+
+
+//				            -----    xferPolicy    -----
+
+
+xferPolicy::xferPolicy(uint32_t inPGN)
+	: linkListObj() {
+	
+	PGN		= basePGN(inPGN);	// We don't care who it's to.
+	rxPrio	= DEF_PRIORITY;	// Middle of the road.
+	txGap		= -1;					// Whatever the class default is.
+	hasRetry	= false;				// Use the list's retry policy.
+}
+
+
+xferPolicy::~xferPolicy(void) {  }
+
+
+
+//				            -----    sourceStats    -----
+
+
+sourceStats::sourceStats(byte inAddr)
+	: linkListObj() {
+	
+	addr			= inAddr;	// Who we're keeping track of.
+	announces	= 0;			// Nothing yet.
+	refused		= 0;			//
+	flooded		= 0;			//
+	superseded	= 0;			//
+	winStart		= millis();	// Window starts now.
+	winCount		= 0;			//
+}
+
+
+sourceStats::~sourceStats(void) {  }
+
+
+// Another BAM or request to send from them. Count it in this window. If the window's
+// over, start a new one. If there's been maxNum already this window, it's one too many.
+bool sourceStats::tally(int maxNum,int windowMs) {
+
+	announces++;													// Seen another.
+	if (millis()-winStart>=(unsigned long)windowMs) {	// This window's done?
+		winStart = millis();										// New one.
+		winCount = 0;												//
+	}																	//
+	if (maxNum>0 && winCount>=maxNum) {						// Too many already?
+		flooded++;													// Flooding us.
+		return false;												// Ignore it.
+	}																	//
+	winCount++;														// Count it.
+	return true;													// Fine.
+}
+
+
+
+//				            -----    xferList    -----
+
+
+xferList::xferList(void)
+	: linkList(), idler() {
+	
+	ourNetObj		= NULL;
+	rxBudget			= RX_BUDGET_BYTES;
+	qHighWater		= RX_Q_HIGH_WATER;
+	poolHighWater	= RX_POOL_HIGH_WATER;
+	activeBAM		= NULL;
+	nextHandle		= NULL;
+	bamSeqNum		= 0;
+	peerSeqNum		= 0;
+	srcMaxSessions	= SRC_MAX_SESSIONS;
+	srcMaxAnnounce	= SRC_MAX_ANNOUNCE;
+	srcWindowMs		= SRC_ANNOUNCE_MS;
+	bamGap			= BAM_GAP_MS;
+	p2pGap			= P2P_GAP_MS;
+	fastPacing		= false;
+}
+	
+	
+xferList::~xferList(void) {  }
+
+
+void xferList::begin(netObj* inNetObj) { ourNetObj = inNetObj; }
+
+
+// Add a sink to the list. NULLs will be filtered out.
+void xferList::addSink(xferSink* inSink) { sinkList.addToTop(inSink); }
+
+
+// Find a sink for this PGN. NULL if no one's interested.
+xferSink* xferList::findSink(uint32_t PGN) {
+
+	xferSink*	trace;
+	
+	PGN = basePGN(PGN);											// We don't care who it's to.
+	trace = (xferSink*)sinkList.getFirst();				// From the top..
+	while(trace) {													// While we have one..
+		if (basePGN(trace->sinkPGN)==PGN) {					// Match?
+			return trace;											// There you go.
+		}															//
+		trace = (xferSink*)trace->getNext();				// Next!
+	}
+	return NULL;													// No one.
+}
+
+
+// Find the policy for this PGN. If there isn't one and create is true, we make one.
+xferPolicy* xferList::findPolicy(uint32_t PGN,bool create) {
+
+	xferPolicy*	trace;
+	
+	PGN = basePGN(PGN);											// We don't care who it's to.
+	trace = (xferPolicy*)policyList.getFirst();			// From the top..
+	while(trace) {													// While we have one..
+		if (trace->PGN==PGN) return trace;					// Match? There you go.
+		trace = (xferPolicy*)trace->getNext();				// Next!
+	}																	//
+	if (create) {													// None, want one?
+		trace = new xferPolicy(PGN);							// Make one.
+		policyList.addToTop(trace);							// NULLs are filtered out.
+	}																	//
+	return trace;
+}
+
+
+// How important are incoming transfers of this PGN? 0 highest, 7 lowest.
+void xferList::setPriority(uint32_t PGN,uint8_t prio) {
+
+	xferPolicy*	aPolicy;
+	
+	aPolicy = findPolicy(PGN,true);
+	if (aPolicy) aPolicy->rxPrio = prio & 0x07;
+}
+
+
+uint8_t xferList::getPriority(uint32_t PGN) {
+
+	xferPolicy*	aPolicy;
+	
+	aPolicy = findPolicy(PGN);
+	if (aPolicy) return aPolicy->rxPrio;
+	return DEF_PRIORITY;
+}
+
+
+void xferList::setRxBudget(uint32_t numBytes) { rxBudget = numBytes; }
+
+
+uint32_t xferList::getRxBudget(void) { return rxBudget; }
+
+
+// Add up the RAM everyone's reassembling into.
+uint32_t xferList::rxBytesUsed(void) {
+
+	xferNode*	trace;
+	uint32_t		sum;
+	
+	sum = 0;
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		sum = sum + trace->rxBytes();
+		trace = (xferNode*)trace->getNext();
+	}
+	return sum;
+}
+
+
+// Can this victim be pushed out for this node? It has to be holding budget RAM, and be
+// either stalled or less important.
+bool xferList::canEvict(xferNode* victim,xferNode* forNode) {
+
+	if (victim==forNode || !victim->rxBytes()) return false;		// Nothing to give.
+	return victim->stalled() || victim->rxPrio>forNode->rxPrio;		// Stalled, or they matter less.
+}
+
+
+// An incoming transfer wants msgSize bytes of budget. If it fits, fine. If not, see if
+// pushing out stalled or less important transfers would make it fit. If so, push them,
+// stalled ones and least important first. If not, don't push anyone. No point.
+bool xferList::makeRoom(xferNode* forNode) {
+
+	xferNode*	trace;
+	xferNode*	victim;
+	uint32_t		used;
+	uint32_t		freeable;
+	
+	if (!rxBudget) return true;												// No limit, no problem.
+	if (forNode->msgSize>rxBudget) return false;							// Never going to fit.
+	used = rxBytesUsed();														// What's in use now.
+	if (used+forNode->msgSize<=rxBudget) return true;					// Fits. Done.
+	freeable = 0;																	// Let's see what we could free up.
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (canEvict(trace,forNode)) freeable = freeable + trace->rxBytes();
+		trace = (xferNode*)trace->getNext();
+	}
+	if (used-freeable+forNode->msgSize>rxBudget) return false;		// Even that won't do it. Leave 'em be.
+	while(used+forNode->msgSize>rxBudget) {								// While we still need room..
+		victim = NULL;
+		trace = (xferNode*)getFirst();
+		while(trace) {																// Find the best one to push out.
+			if (canEvict(trace,forNode)) {
+				if (!victim) {
+					victim = trace;
+				} else if (trace->stalled()!=victim->stalled()) {		// Stalled beats not stalled.
+					if (trace->stalled()) victim = trace;
+				} else if (trace->rxPrio>victim->rxPrio) {				// Then the least important.
+					victim = trace;
+				}
+			}
+			trace = (xferNode*)trace->getNext();
+		}
+		if (!victim) return false;												// Shouldn't happen, but..
+		used = used - victim->rxBytes();										// That's freed up.
+		victim->evict();															// Off you go.
+	}
+	return true;
+}
+
+
+void xferList::setHighWater(int numMsgs,uint32_t numBytes) {
+
+	qHighWater		= numMsgs;
+	poolHighWater	= numBytes;
+}
+
+
+// Are we too backed up to take more data right now? Either the message queue's too deep
+// or everyone else's reassembly RAM is over its mark. If they're already holding, they
+// wait 'till it drains to half. That way we're not flapping back and forth.
+bool xferList::backedUp(xferNode* forNode,bool resuming) {
+
+	int		qMark;
+	uint32_t	poolMark;
+	
+	qMark		= qHighWater;															// Normal marks.
+	poolMark	= poolHighWater;														//
+	if (resuming) {																	// Already holding?
+		qMark		= qMark/2;															// Drain to half.
+		poolMark	= poolMark/2;														//
+	}																						//
+	if (qHighWater && ourNetObj->ourMsgQ.getDepth()>qMark) return true;	// Handlers are behind.
+	if (poolHighWater && rxBytesUsed()-forNode->rxBytes()>poolMark) {		// Everyone else is using too much RAM.
+		return true;																	//
+	}																						//
+	return false;																		// We're good.
+}
+
+
+// Time between outgoing broadcast packets. J1939 wants 50 to 200 ms.
+void xferList::setBAMGap(int ms) { bamGap = ms; }
+
+
+// Time between outgoing peer to peer data packets.
+void xferList::setP2PGap(int ms) { p2pGap = ms; }
+
+
+// This PGN gets its own gap. -1 goes back to the class default.
+void xferList::setTxGap(uint32_t PGN,int ms) {
+
+	xferPolicy*	aPolicy;
+	
+	aPolicy = findPolicy(PGN,true);
+	if (aPolicy) aPolicy->txGap = ms;
+}
+
+
+// Default retry policy for outgoing transfers.
+void xferList::setRetry(xferRetry* inRetry) { if (inRetry) defRetry = *inRetry; }
+
+
+// This PGN gets its own retry policy. NULL goes back to the default.
+void xferList::setRetry(uint32_t PGN,xferRetry* inRetry) {
+
+	xferPolicy*	aPolicy;
+	
+	aPolicy = findPolicy(PGN,inRetry!=NULL);				// Only make one if we're setting something.
+	if (aPolicy) {
+		if (inRetry) {
+			aPolicy->retry = *inRetry;
+			aPolicy->hasRetry = true;
+		} else {
+			aPolicy->hasRetry = false;
+		}
+	}
+}
+
+
+// The retry policy for this PGN. Its own, or the default.
+xferRetry* xferList::getRetry(uint32_t PGN) {
+
+	xferPolicy*	aPolicy;
+	
+	aPolicy = findPolicy(PGN);
+	if (aPolicy && aPolicy->hasRetry) return &(aPolicy->retry);
+	return &defRetry;
+}
+
+
+// How many incoming transfers a source can have going at once, and how many it can start
+// in windowMs. Zero for no limit.
+void xferList::setSourceLimits(int maxSessions,int maxAnnounce,int windowMs) {
+
+	srcMaxSessions	= maxSessions;
+	srcMaxAnnounce	= maxAnnounce;
+	srcWindowMs		= windowMs;
+}
+
+
+// Find the stats for this source. If there aren't any and create is true, we make some.
+sourceStats* xferList::findSource(byte srcAddr,bool create) {
+
+	sourceStats*	trace;
+	
+	trace = (sourceStats*)sourceList.getFirst();			// From the top..
+	while(trace) {													// While we have one..
+		if (trace->addr==srcAddr) return trace;			// Match? There you go.
+		trace = (sourceStats*)trace->getNext();			// Next!
+	}																	//
+	if (create) {													// None, want one?
+		trace = new sourceStats(srcAddr);					// Make one.
+		sourceList.addToTop(trace);							// NULLs are filtered out.
+	}																	//
+	return trace;
+}
+
+
+// How many incoming transfers does this source have running?
+int xferList::sessionsFrom(byte srcAddr) {
+
+	xferNode*	trace;
+	int			count;
+	
+	count = 0;
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (trace->incoming && !trace->complete && trace->msgAddr==srcAddr) {
+			count++;
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+	return count;
+}
+
+
+// They started a new broadcast. Whatever broadcast they were sending before is history.
+// Pass back how many we dropped.
+int xferList::supersedeBAM(byte srcAddr) {
+
+	xferNode*	trace;
+	int			count;
+	
+	count = 0;
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (trace->bamFrom(srcAddr)) {				// Their old broadcast?
+			trace->success = false;					// Didn't finish.
+			trace->complete = true;					// And never will.
+			count++;										//
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+	return count;
+}
+
+
+// Turn away a request to send without setting anything up for it. Just send the abort.
+void xferList::refuseXfer(message* reqMsg,abortReason reason) {
+
+	message	flowContMsg;
+	
+	flowContMsg.setPriority(7);									// Same bits as any flow control.
+	flowContMsg.setR(0);												//
+	flowContMsg.setDP(0);											//
+	flowContMsg.setPDUf(reqMsg->getPDUf());					// TP or ETP, whatever they asked with.
+	flowContMsg.setPDUs(reqMsg->getSourceAddr());			// Back to them.
+	flowContMsg.setSourceAddr(ourNetObj->getAddr());		// From us.
+	flowContMsg.setDataByte(0,abortMsg);						// It's an abort.
+	flowContMsg.setDataByte(1,(byte)reason);					// And why.
+	flowContMsg.setDataByte(2,0xFF);								//
+	flowContMsg.setDataByte(3,0xFF);								//
+	flowContMsg.setDataByte(4,0xFF);								//
+	flowContMsg.setDataByte(5,reqMsg->getDataByte(5));		// Their PGN.
+	flowContMsg.setDataByte(6,reqMsg->getDataByte(6));		//
+	flowContMsg.setDataByte(7,reqMsg->getDataByte(7));		//
+	ourNetObj->outgoingingMsg(&flowContMsg);					// Off it goes.
+}
+
+
+// Someone's starting a transfer. Before we spend any RAM on it, make sure they're not
+// flooding us, or already have all the transfers running they're allowed.
+void xferList::admitXfer(message* ioMsg,xferTypes xferType) {
+
+	sourceStats*	stats;
+	byte				srcAddr;
+	
+	srcAddr = ioMsg->getSourceAddr();							// Who's this from?
+	stats = findSource(srcAddr,true);							// What have they been up to?
+	if (stats && !stats->tally(srcMaxAnnounce,srcWindowMs)) {	// Too many, too fast?
+		return;															// Ignore it. Don't even answer.
+	}																		//
+	if (xferType==broadcastIn) {									// A new broadcast..
+		if (supersedeBAM(srcAddr) && stats) {					// Replaces any they were sending.
+			stats->superseded++;									// Count it.
+		}																	//
+	}																		//
+	if (srcMaxSessions && sessionsFrom(srcAddr)>=srcMaxSessions) {	// Already have all they can?
+		if (stats) stats->refused++;								// Count it.
+		if (xferType!=broadcastIn) {								// Peer to peer?
+			refuseXfer(ioMsg,busyAbort);							// Tell 'em we're busy.
+		}																	// Broadcasts, just ignored.
+		return;															// And that's that.
+	}																		//
+	addXfer(ioMsg,xferType);										// All good, set it up.
+}
+
+
+// Closed segment? Lift the J1939 broadcast gap limits.
+void xferList::setFastPacing(bool onOff) { fastPacing = onOff; }
+
+
+// What gap does this PGN get? Its own if it has one, else its class default. Broadcasts
+// are held to 50..200 ms unless we're in fast mode.
+int xferList::getTxGap(uint32_t PGN,bool broadcast) {
+
+	xferPolicy*	aPolicy;
+	int			gap;
+	
+	gap = broadcast ? bamGap : p2pGap;						// Class default.
+	aPolicy = findPolicy(PGN);									// Have our own?
+	if (aPolicy && aPolicy->txGap>=0) gap = aPolicy->txGap;	// Use it.
+	if (broadcast && !fastPacing) {							// Broadcast on a shared bus?
+		if (gap<TWMIN_MS) gap = TWMIN_MS;					// Not too fast..
+		if (gap>TWMAX_MS) gap = TWMAX_MS;					// Not too slow.
+	}																	//
+	if (gap<0) gap = 0;											// And no time travel.
+	return gap;
+}
+
+
+// When we're running late, how close can packets get while we catch up?
+int xferList::getMinGap(bool broadcast) {
+
+	if (broadcast && !fastPacing) return TWMIN_MS;		// J1939's minimum.
+	return 0;														// Peer to peer, or fast mode. Back to back is fine.
+}
+
+
+// One outgoing broadcast at a time. If the one that was sending is done, pick the next
+// one. Most important first, then the order they came in. It sends its announcement on
+// the shared clock, so there's always a full gap between broadcasts.
+void xferList::scheduleBAM(void) {
+
+	xferNode*				trace;
+	outgoingBroadcast*	aBAM;
+	outgoingBroadcast*	nextBAM;
+	int						gapMs;
+	
+	if (activeBAM && !activeBAM->complete) return;				// Someone's sending. Wait.
+	activeBAM = NULL;														// Whoever it was, it's done.
+	if (!bamPacer.isDue()) return;									// Wait out the gap.
+	nextBAM = NULL;
+	trace = (xferNode*)getFirst();
+	while(trace) {															// Look through the list..
+		aBAM = trace->queuedBAM();										// Only queued broadcasts care.
+		if (aBAM && (!nextBAM || aBAM->goesBefore(nextBAM))) {	// If it's first so far..
+			nextBAM = aBAM;												// Save it.
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+	if (nextBAM) {															// Found one?
+		activeBAM = nextBAM;												// It's up.
+		activeBAM->startBAM();											// Announce.
+		gapMs = getTxGap(activeBAM->xferPGN,true);				// And the data waits a gap.
+		bamPacer.markSent(gapMs,gapMs);								// A full one, from now. Not what's left of an old deadline.
+	}
+}
+
+
+// Are we in the middle of an outgoing peer to peer with this address? Ones waiting in line
+// don't count.
+bool xferList::peerBusy(byte peerAddr) {
+
+	xferNode*	trace;
+	
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (trace->toPeer && !trace->complete && !trace->waitTurn && trace->msgAddr==peerAddr) {
+			return true;
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+	return false;
+}
+
+
+// Who's been waiting the longest for this peer?
+xferNode* xferList::nextForPeer(byte peerAddr) {
+
+	xferNode*	trace;
+	xferNode*	first;
+	
+	first = NULL;
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (trace->waitTurn && !trace->complete && trace->msgAddr==peerAddr) {
+			if (!first || trace->peerSeq<first->peerSeq) {
+				first = trace;
+			}
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+	return first;
+}
+
+
+// Anyone in line for a peer that's now free? Start 'em. One per peer.
+void xferList::schedulePeers(void) {
+
+	xferNode*	trace;
+	xferNode*	nextUp;
+	
+	trace = (xferNode*)getFirst();
+	while(trace) {														// Look through the list..
+		if (trace->waitTurn && !trace->complete) {				// Someone in line..
+			if (!peerBusy(trace->msgAddr)) {						// And their peer is free?
+				nextUp = nextForPeer(trace->msgAddr);				// Whoever's been waiting longest.
+				nextUp->waitTurn = false;							// Out of line.
+				nextUp->startXfer();									// And off they go.
+			}
+		}
+		trace = (xferNode*)trace->getNext();
+	}
+}
+
+
+// How long 'till some outgoing packet is due? -1 means nothing's waiting to go.
+long xferList::nextTxMs(void) {
+
+	xferNode*	trace;
+	long			soonest;
+	long			togo;
+	
+	soonest = -1;															// Nothing yet.
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		if (trace->queuedBAM()) {										// A broadcast waiting its turn?
+			togo = bamPacer.msToGo();									// Next announce waits on the shared clock.
+			if (activeBAM) togo = -1;									// Unless someone's already sending. They'll say.
+		} else {																//
+			togo = trace->msToTx();										// Ask the node.
+			if (trace==activeBAM) togo = bamPacer.msToGo();		// The sending broadcast runs on the shared clock.
+			if (togo>=0 && trace->bwWait()>togo) {					// And if it's over its share of the bus..
+				togo = trace->bwWait();									// It waits for that too.
+			}
+		}
+		if (togo>=0 && (soonest<0 || togo<soonest)) soonest = togo;
+		trace = (xferNode*)trace->getNext();
+	}
+	return soonest;
+}
+
+
+// Send whatever's due. Start the next broadcast if it's time, then let everyone with
+// packets to pace have a go.
+void xferList::serviceTx(void) {
+
+	xferNode*	trace;
+	
+	scheduleBAM();
+	schedulePeers();
+	trace = (xferNode*)getFirst();
+	while(trace) {
+		trace->serviceTx();
+		trace = (xferNode*)trace->getNext();
+	}
+}
+
+
+// Either we create a new outgoing extended message. Or, we received from the net a new
+// incoming extended message. Create the suitable handler node with the initial message
+// that started it. Then, add this new node to the xferNode list.
+void xferList::addXfer(message* ioMsg,xferTypes xferType) {
+
+	xferNode*	newXferNode;
+	
+	newXferNode = NULL;
+	switch(xferType) {
+		case broadcastIn		:	// We received a "BAM message".
+			newXferNode = (xferNode*) new incomingBroadcast(ioMsg,ourNetObj,this);
+		break;
+		case broadcastOut		:	// We created a "BAM message".
+			newXferNode = (xferNode*) new outgoingBroadcast(ioMsg,ourNetObj,this);
+		break;
+		case peerToPeerIn		:	// We received a "request to send" from a peer.
+			newXferNode = (xferNode*) new incomingPeerToPeer(ioMsg,ourNetObj,this);
+		break;
+		case peerToPeerOut	:	// We created a "request to send" for a peer.
+			newXferNode = (xferNode*) new outgoingPeerToPeer(ioMsg,ourNetObj,this);
+		break;
+		case extendedIn		:	// We received an extended "request to send" from a peer.
+			newXferNode = (xferNode*) new incomingExtended(ioMsg,ourNetObj,this);
+		break;
+		case extendedOut		:	// We created an extended "request to send" for a peer.
+			newXferNode = (xferNode*) new outgoingExtended(ioMsg,ourNetObj,this);
+		break;
+	}
+	if (newXferNode) {							// If we got one..
+		newXferNode->attachHandle(nextHandle);	// If sendXfer() left a handle, it's this one's.
+		nextHandle = NULL;						// Used up.
+		if (newXferNode->complete) {			// And it's dead on arrival? (Refused, no room..)
+			delete(newXferNode);					// Don't let 'em pile up waiting for cleanup.
+		} else {										// Else, it's running..
+			addToTop(newXferNode);				// Onto the list.
+		}
+	}
+}
+
+
+
+bool xferList::checkList(message* ioMsg) {
+
+	bool			handled;
+	xferNode*	trace;
+	
+	handled = false;													// Assume we don't handle this.
+	trace = (xferNode*)getFirst();								// Grab first handler node from the list.
+	while(trace && !handled) {										// While we have non NULL node. AND message has not been handled..
+		handled = trace->handleMsg(ioMsg);						// Ask each node if they want/need to handle this message.
+		trace = (xferNode*)trace->getNext();					// Then grab the next node regardless of the answer.
+	}
+	return handled;
+}	
+
+
+// Ok, a message has come in from either the net, OR, we wrote it. It could be a start of
+// a transfer we need to deal with. It could be part of a message we are already dealing
+// with. Most likely it's nothing that concerns us. But, we get first right of refusal. So
+// lets have a look at it.
+bool xferList::handleMsg(message* ioMsg,bool received) {
+
+	
+	bool			handled;
+	uint32_t		PGN;
+	
+	handled = false;																		// Ain't handled nuthin' yet.
+	if (ioMsg) {																			// Sanity, check we got something.
+		if (received) {																	// From the network!
+			if (ioMsg->getPDUf()==FLOW_CON_PF) {									// If it's an incoming TP message..
+				switch((int)ioMsg->getDataByte(0)) {
+					case reqToSend		:													// REQUEST TO SEND : New Peer to peer incoming.
+						PGN = ioMsg->getData5PGN();									// Lets see what this TP is all about.
+						if (!isBroadcastPGN(PGN)) {									// See if the multi packet message is peer to peer..
+							if ((PGN & 0xFF)==ourNetObj->addr) {					// And it's to us.
+								admitXfer(ioMsg,peerToPeerIn);						// Setup a peer to peer transfer.
+								handled = true;											//	This message has been handled!
+							}																	//
+						}																		// 	
+					break;																	//
+					case clearToSend	: handled = checkList(ioMsg); break;	// CLEAR TO SEND : Hand it to the list, done.
+					case endOfMsg		: handled = checkList(ioMsg); break;	// END OF MESSAGE : Hand it to the list, done.
+					case BAM				: 													// BROADCAST ANNOUNCE MESSGE : New broadcast incoming.
+						PGN = ioMsg->getData5PGN();									// Lets see what this TP is all about.
+						if (isBroadcastPGN(PGN)) {										// See if the multi packet message actually is a broadcast..
+							admitXfer(ioMsg,broadcastIn);								// Setup a brodcast transfer.
+							handled = true;												//	And this message has been handled!
+						}																		//
+					break;																	//
+					case abortMsg		: handled = checkList(ioMsg); break;	// ABORT MESSGE : Hand it to the list, done.
+				}																				//
+			} else if (ioMsg->getPDUf()==DATA_XFER_PF) {							// DATA TRANSFER MESSGE : An incoming dats packet..
+				handled = checkList(ioMsg);											// Hand it to the list, done.
+			} else if (ioMsg->getPDUf()==ETP_FLOW_CON_PF) {						// EXTENDED TP MESSAGE : Peer to peer only..
+				if (ioMsg->getPDUs()==ourNetObj->addr) {							// So only if it's to us.
+					if (ioMsg->getDataByte(0)==etpReqToSend) {					// EXTENDED REQUEST TO SEND : New incoming.
+						admitXfer(ioMsg,extendedIn);									// Setup an extended transfer.
+						handled = true;													// Handled.
+					} else {																	// Anything else..
+						handled = checkList(ioMsg);									// Hand it to the list, done.
+					}																			//
+				}																				//
+			} else if (ioMsg->getPDUf()==ETP_DATA_XFER_PF) {						// EXTENDED DATA TRANSFER : An incoming data packet..
+				handled = checkList(ioMsg);											// Hand it to the list, done.
+			}																					//
+		} else if (ioMsg->getNumBytes()>TP_MAX_BYTES) {							// Else if WE wrote a really oversized message..
+			if (!ioMsg->isBroadcast()) {												// Extended transport is peer to peer only.
+				addXfer(ioMsg,extendedOut);											// Set up an extended transfer.
+				handled = true;																// It's been handled.
+			}																					// No way to broadcast these. Not handled.
+		} else if (ioMsg->getNumBytes()>8) {										// Else if WE wrote an oversized message..
+			if (ioMsg->isBroadcast()) {												// If the message itself is a broadcast..
+				addXfer(ioMsg,broadcastOut);											// Setup a multi packet brodcast transfer.
+			} else {																			// Else it's NOT a broadcast..
+				addXfer(ioMsg,peerToPeerOut);											// Set up a multi packet peer to peer transfer.
+			}																					//
+			handled = true;																// In any case, it's been handled.
+		}																						//		
+	}																							//
+	return handled;																		// And we return our result.
+}
+
+
+// Is there a transfer node that's currently waiting on anything?
+bool xferList::anyoneWaiting(void) {
+
+	xferNode*	trace;
+	
+	trace = (xferNode*)getFirst();							// Grab the pointer to the top of the list.
+	while(trace) {													// While we don't have a null pointer..
+		if (!trace->complete) {									// If this node is still running..
+			if (trace->xFerTimer.getFraction()!=100) {	// If it's currently busy.
+				return true;										// Found a busy one! Return true.
+			}															// If this node was NOT complete..
+		}																//
+		trace = (xferNode*)trace->getNext();				// We jump to the next. (Till we hit a null pointer.)
+	}																	//
+	return false;													// I guess no one is busy. Return false.
+}
+
+
+// Basic garbage collection. Any transfer message nodes completed get marked as complete
+// and need to be recycled. Actually we only need to kill off one. This will be called
+// over and over so, if there are more, the'll get hit soon.
+void  xferList::listCleanup(void) {
+
+	xferNode*	trace;
+	
+	trace = (xferNode*)getFirst();					// Grab the pointer to the top of the list.
+	while(trace) {											// While we don't have a null pointer..
+		if (trace->complete) {							// If this node is complete..
+			unlinkObj(trace);								// Unlink the node.
+			delete(trace);									// Recycle the node.
+			trace = NULL;									// One node killing is enough. Null out the pointer.
+		} else {												// If this node was NOT complete..
+			trace = (xferNode*)trace->getNext();	// We jump to the next. (Till we hit a null pointer.)
+		}
+	}	
+}
+
+
+// Maintain the list and let all the current transfers do their thing.
+void  xferList::idle(void) {
+
+	xferNode*	trace;
+	
+	listCleanup();										// If we can find a completed node, we'll recycle it.
+	serviceTx();										// Send anything that's due.
+	trace = (xferNode*)getFirst();				// Grab pointer to top of list.
+	while(trace) {										// While we don't have a null pointer..
+		trace->idleTime();							// Give each node some time to do stuff.
+		trace = (xferNode*)trace->getNext();	// We jump to the next node. (Till we hit a null pointer.)
+	}
+}
+
+
+
+// ***************************************************************************************
+//				              ----- mesgQ. Hold 'em in here. -----
+// ***************************************************************************************
+
+
+// Put together from a transfer we let in. So it's for us, and too big to be a request.
+msgObj::msgObj(message* inMsg)
+	: linkListObj(),
+	message(inMsg) {
+	
+	rxClass		= getClass();
+	forUs			= true;
+	isRequest	= false;
+}
+
+
+// When whoever made us already knows what kind it is, and if it's for us.
+msgObj::msgObj(message* inMsg,frameClass inClass,bool inForUs)
+	: linkListObj(),
+	message(inMsg) {
+	
+	rxClass		= inClass;
+	forUs			= inForUs;
+	isRequest	= rxClass==requestFrame && getNumBytes()==3 && forUs;
+}
+
+
+msgObj::~msgObj(void) { }					
+					
+
+coalescePGN::coalescePGN(uint32_t inPGN)
+	: linkListObj() { PGN = inPGN; }
+
+
+coalescePGN::~coalescePGN(void) {  }
+
+
+
+msgQ::msgQ(void) {
+
+	depth		= 0;
+	ctrlDepth	= 0;
+	maxDepth	= RX_Q_MAX_DEPTH;
+	shed		= 0;
+	coalesced	= 0;
+}
+
+
+// The queue cleans up the data. The control queue's a member, it cleans up after itself.
+msgQ::~msgQ(void) {  }
+
+
+// We keep count as they go in and out. Walking the list to count them every time the
+// transfers want to know is a waste. Control goes in its own line. Data, if we're full,
+// we make room for by shedding. If we can't, and it's a plain frame, it's the one shed.
+void msgQ::push(linkListObj* newObj) {
+
+	msgObj*	aMsg;
+	
+	if (newObj) {
+		aMsg = (msgObj*)newObj;
+		if (isControl(aMsg)) {											// Control?
+			ctrlQ.push(aMsg);												// Front of the line, never shed.
+			ctrlDepth++;													//
+		} else {																//
+			if (maxDepth && depth>=maxDepth) {						// Full up?
+				if (!shedData()) {										// Couldn't make room?
+					if (aMsg->getNumBytes()<=8) {						// If this is just a frame..
+						delete(aMsg);										// It's shed.
+						shed++;												//
+						return;												// That's it.
+					}															// A transfer gets in anyway.
+				}																//
+			}																	//
+			queue::push(aMsg);											// Into the data line.
+		}																		//
+		depth++;
+	}
 }
 
-// BYTE 4 : In a broadcast this is supposed to be set to 0xFF meaning unlimited amount of
-// packets. But in response to a Clear-To-Send from a peer? It is to be set to the max
-// number of packets to be sent. Or 0xFF for unlimited.. So what is this unlimited thing
-// saying? Are we establishing a data stream? I think not! This is nonsense. We already,
-// with BYTE 3, established the number of packets to be sent.
-//
-// Hence: I'll set it to 0xFF (unlimited) for now.
 
+// Control first, always.
+linkListObj* msgQ::pop(void) {
 
+	linkListObj*	anObj;
+	
+	anObj = ctrlQ.pop();
+	if (anObj) {
+		ctrlDepth--;
+	} else {
+		anObj = queue::pop();
+	}
+	if (anObj) depth--;
+	return anObj;
+}
 
-//				          -----    outgoingBroadcast    -----
 
+int msgQ::getDepth(void) { return depth; }
 
-outgoingBroadcast::outgoingBroadcast(message* inMsg,netObj* inNetObj,xferList* inList)
-	: xferNode(inNetObj,inList) {
+
+int msgQ::getCtrlDepth(void) { return ctrlDepth; }
+
+
+// What has timers riding on it? Address claims and their requests, acks, commanded
+// addresses. Transport control never gets in here, the xferList takes it as it comes in.
+bool msgQ::isControl(msgObj* aMsg) {
+
+	switch(aMsg->rxClass) {
+		case ackFrame		:
+		case requestFrame	:
+		case claimFrame	:
+		case commandFrame	: return true;
+		default				: return false;
+	}
+}
+
+
+void msgQ::setCoalesce(uint32_t PGN,bool onOff) {
+
+	coalescePGN*	trace;
 	
-	success = false;								// We assume this will fail. Such a bad attitude.
-	complete = true;								// We are done.
-	reason = noReason;							// And it's because WE did something wrong.
-	if (inMsg && inNetObj) {					// OK. As always, check sanity..
-		msgSize = inMsg->getNumBytes();		// Save off the size. (used later)
-		if (msgSize>8) {							// If its's too big..
-			saveFCID(inMsg);						// Save off the PGN for later.
-			msgData = inMsg->passData();		// Hands over the actual data to us. (Yes messages can do this.)
-			msgPacks = msgSize/7;				// Seven goes into num bytes.?.
-			if (msgSize%7) {						//	We got leftovers?
-				 msgPacks++;						// Then add one.
-			}											// (msgPack is used later.)
-			msgAddr = GLOBAL_ADDR;				// Send to.. Everyone?
-			sendflowControlMsg(BAM);			// Send a BAM message.
-			startTimer(TWMIN_MS,TWMAX_MS);	// We don't send another 'till the timer dings.
-			complete = false;						// Successfully started. So, not complete.
+	PGN = basePGN(PGN);
+	trace = (coalescePGN*)coalesceList.getFirst();
+	while(trace) {
+		if (trace->PGN==PGN) {
+			if (!onOff) {
+				coalesceList.unlinkObj(trace);
+				delete(trace);
+			}
+			return;
 		}
-	}			
+		trace = (coalescePGN*)trace->getNext();
+	}
+	if (onOff) coalesceList.addToTop(new coalescePGN(PGN));
 }
 
 
-// If we grabbed the data buffer? We'll deal with it here..	
-outgoingBroadcast::~outgoingBroadcast(void) {
+bool msgQ::wantsCoalesce(uint32_t PGN) {
 
-	if (msgData) {			// If msgData is non NULL. (We used it.)
-		free(msgData);		// Recycle the RAM.
-		msgData = NULL;	// Flag it as recycled so no one else tries to free it.
+	coalescePGN*	trace;
+	
+	trace = (coalescePGN*)coalesceList.getFirst();
+	while(trace) {
+		if (trace->PGN==PGN) return true;
+		trace = (coalescePGN*)trace->getNext();
 	}
+	return false;
 }
 
 
-// Broadcasts do all their work blindly by timer in this idle routine.
-void outgoingBroadcast::idleTime(void) {
+// If this is a latest value PGN, and there's one from the same stream waiting in the
+// data line, we write the new one over it. It keeps its place. true if we did. Then
+// the new one doesn't need to be queued at all.
+bool msgQ::coalesce(message* inMsg) {
+
+	msgObj*		trace;
+	uint32_t		PGN;
+	byte			source;
 	
-	if (!complete) {									// If we're currently running..
-		if (xFerTimer.ding()) {						// If our timer has expired..
-			complete = sendDataMsg();				// Pack up and send a data message.
-			if (complete) {							// If that was the last data packet..
-				success = true;						// Then, as far as we know, this was a success.
-			}
+	if (!coalesceList.getFirst()) return false;							// None marked? Quick out.
+	if (inMsg->getNumBytes()>8) return false;								// Only plain frames.
+	PGN = inMsg->getPGN();														// Which stream.. (PDU1, destination and all)
+	if (!wantsCoalesce(basePGN(PGN))) return false;						// Not one of ours.
+	source = inMsg->getSourceAddr();											//
+	trace = (msgObj*)getFirst();												// Look for one waiting..
+	while(trace) {																	//
+		if (trace->getSourceAddr()==source &&								// Same source..
+			trace->getPGN()==PGN &&												// Same PGN, to the same place..
+			trace->getNumBytes()<=8) {											// Plain frame.
+			trace->setCANID(inMsg->getCANID());								// Take the new one's ID. (Priority)
+			trace->setNumBytes(inMsg->getNumBytes());						// And data.
+			for (int i=0;i<inMsg->getNumBytes();i++) {					//
+				trace->setDataByte(i,inMsg->getDataByte(i));				//
+			}																			//
+			coalesced++;															// Count it.
+			return true;															// Done.
+		}																				//
+		trace = (msgObj*)trace->getNext();									//
+	}																					//
+	return false;																	// Nothing waiting, queue it.
+}
+
+
+// Find the oldest plain frame in the data line and lose it.
+bool msgQ::shedData(void) {
+
+	msgObj*	trace;
+	
+	trace = (msgObj*)getFirst();
+	while(trace) {
+		if (trace->getNumBytes()<=8) {
+			unlinkObj(trace);
+			delete(trace);
+			depth--;
+			shed++;
+			return true;
 		}
+		trace = (msgObj*)trace->getNext();
 	}
+	return false;
 }
 
 
 
-//				          -----    outgoingPeerToPeer    -----
+// ***************************************************************************************
+//				     ----- rxRing. Frames straight from the hardware. -----
+// ***************************************************************************************
 
 
-// The outside world thinks this message should be broken into packets to be send out.
-// We'll have a look and see if this is the case.
-outgoingPeerToPeer::outgoingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList)
-	: xferNode(inNetObj,inList) {
+#if (RX_RING_SIZE & (RX_RING_SIZE-1)) || RX_RING_SIZE>128
+#error RX_RING_SIZE must be a power of two, 128 or less.
+#endif
 
-	complete = true;											// Assume we are done here.
-	success = false;											// Assume failure.
-	if (inMsg) {												// Always check sanity..
-		msgSize = inMsg->getNumBytes();					// Save off the size. Just in case..
-		if (msgSize>8) {										// If its's too big..
-			if (!inMsg->isBroadcast()) {					// If it's NOT to everyone.. (Peer to peer)
-				saveFCID(inMsg);					// Save off the PGN for later.
-				msgData = inMsg->passData();				// Hand over the actual data to us. (messages can do this, very scary.)
-				msgPacks = msgSize/7;						// Seven goes into num bytes?.
-				if (msgSize%7) {								//	We got leftovers?
-					 msgPacks++;								// Then add one.
-				}													// 
-				msgAddr = inMsg->getPDUs();				// Peer to peer to.. 
-				sendflowControlMsg(reqToSend);			// Send a reqToSend message.					
-				ourState = waitToSend;						// We don't send another 'till they say it's ok.							
-				xFerTimer.setTime(TR_MS,true);			// We allow this much time for a clear to send to come in.
-				complete = false;								// Ok. Meets all criteria. Do not kill us yet, we're still running.
-			}
-		}	
-	}			
+
+rxRing::rxRing(void) {
+
+	head		= 0;
+	tail		= 0;
+	overflows	= 0;
+}
+
+
+rxRing::~rxRing(void) {  }
+
+
+// The writer side. Copy the frame into the next free slot, then move head. Only after
+// the slot is filled. The barrier keeps the compiler, and the processor, from moving the
+// head update ahead of the copy. Otherwise the reader could grab a half written slot.
+bool rxRing::put(uint32_t CANID,uint8_t numBytes,const uint8_t* data) {
+
+	rxSlot*	slot;
+	uint8_t	ourHead;
+	
+	ourHead = head;															// Only we change it.
+	if ((uint8_t)(ourHead-tail)>=RX_RING_SIZE) {						// Full?
+		overflows = overflows + 1;											// Count the one we lost.
+		return false;															// And that's it.
+	}																				//
+	if (numBytes>8) numBytes = 8;											// CAN frames don't get bigger.
+	slot = &(slots[ourHead & (RX_RING_SIZE-1)]);						// Our slot.
+	slot->CANID		= CANID;													// Fill it in.
+	slot->numBytes	= numBytes;												//
+	for (uint8_t i=0;i<numBytes;i++) {									//
+		slot->data[i] = data[i];											//
+	}																				//
+	__sync_synchronize();													// All that lands before..
+	head = ourHead+1;															// It's published.
+	return true;
+}
+
+
+// The reader side. Same dance backwards. Copy it out, then hand the slot back.
+bool rxRing::get(message* outMsg) {
+
+	rxSlot*	slot;
+	uint8_t	ourTail;
+	
+	ourTail = tail;															// Only we change it.
+	if (ourTail==head) return false;										// Nothing waiting.
+	__sync_synchronize();													// See the slot as it was when head moved.
+	slot = &(slots[ourTail & (RX_RING_SIZE-1)]);						// The oldest one.
+	outMsg->setNumBytes(slot->numBytes);								// Copy it out.
+	outMsg->setCANID(slot->CANID);										//
+	for (uint8_t i=0;i<slot->numBytes;i++) {							//
+		outMsg->setDataByte(i,slot->data[i]);							//
+	}																				//
+	__sync_synchronize();													// Done reading before..
+	tail = ourTail+1;															// We let the writer have it back.
+	return true;
+}
+
+
+uint8_t rxRing::getDepth(void) { return head-tail; }
+
+
+// On 8 bit processors a long isn't read in one go. If you call this while frames are
+// being dropped you may catch it mid update. It's a counter, near enough.
+uint32_t rxRing::getOverflows(void) { return overflows; }
+
+
+void rxRing::resetOverflows(void) { overflows = 0; }
+
+
+
+// ***************************************************************************************
+//				     ----- pgnIndex. Who wants what PGN. -----
+// ***************************************************************************************
+
+
+pgnRange::pgnRange(uint32_t inFirstPGN,uint32_t inLastPGN,msgHandler* inHandler)
+	: linkListObj() {
+
+	firstPGN	= inFirstPGN;
+	lastPGN	= inLastPGN;
+	handler	= inHandler;
+}
+
+
+pgnRange::~pgnRange(void) {  }
+
+
+
+pgnIndex::pgnIndex(void) {
+
+	entries		= NULL;
+	numEntries	= 0;
+	maxEntries	= 0;
+	plain			= NULL;
+	numPlain		= 0;
+	maxPlain		= 0;
+}
+
+
+// The ranges list recycles its own.
+pgnIndex::~pgnIndex(void) {
+
+	resizeBuff(0,&entries);
+	resizeBuff(0,&plain);
 }
+
+
+// Slot it in. Sorted by PGN, and within a PGN by when the handler was added to the
+// netObj. So the handlers added first are found first. The array grows in steps of eight
+// so adding a bunch doesn't mean a new array every time.
+bool pgnIndex::addPGN(uint32_t PGN,msgHandler* inHandler) {
+
+	pgnEntry*	newEntries;
+	int			lo;
+	int			hi;
+	int			mid;
 	
+	if (!inHandler) return false;											// Sanity.
+	PGN = basePGN(PGN);														// No destinations in here.
+	if (numEntries==maxEntries) {											// Full?
+		newEntries = NULL;													// resizeBuff() wants a NULL to start.
+		if (!resizeBuff(maxEntries+8,&newEntries)) return false;	// No RAM? Then no.
+		for (int i=0;i<numEntries;i++) {									// Copy over what we have..
+			newEntries[i] = entries[i];									//
+		}																			//
+		resizeBuff(0,&entries);												// Recycle the old one.
+		entries = newEntries;												// And the new one is ours.
+		maxEntries = maxEntries+8;											//
+	}																				//
+	lo = 0;																		// Binary search for the first entry
+	hi = numEntries;															// that should come after ours.
+	while(lo<hi) {																//
+		mid = (lo+hi)/2;														//
+		if (entries[mid].PGN<PGN ||										//
+			(entries[mid].PGN==PGN && entries[mid].handler->regSeq<=inHandler->regSeq)) {
+
+			lo = mid+1;															//
+		} else {																	//
+			hi = mid;															//
+		}																			//
+	}																				//
+	for (int i=numEntries;i>lo;i--) {										// Make a hole there.
+		entries[i] = entries[i-1];											//
+	}																				//
+	entries[lo].PGN		= PGN;												// Fill it in.
+	entries[lo].handler	= inHandler;										//
+	numEntries++;																//
+	return true;
+}
+
 
-// If we grabbed the data buffer? We'll deal with it here..	
-outgoingPeerToPeer::~outgoingPeerToPeer(void) {
+// Ranges are kept in the order their handlers were added too.
+bool pgnIndex::addRange(uint32_t firstPGN,uint32_t lastPGN,msgHandler* inHandler) {
 
-	if (msgData) {			// If outData is non NULL. (We used it.)
-		free(msgData);		// Recycle the RAM.
-		msgData = NULL;	// Flag it as recycled so no one else tries to free it.
+	pgnRange*	newRange;
+	pgnRange*	trace;
+	pgnRange*	prev;
+	
+	if (!inHandler) return false;
+	if (lastPGN<firstPGN) return false;
+	newRange = new pgnRange(firstPGN,lastPGN,inHandler);
+	if (!newRange) return false;
+	prev = NULL;
+	trace = (pgnRange*)ranges.getFirst();
+	while(trace && trace->handler->regSeq<=inHandler->regSeq) {
+		prev = trace;
+		trace = (pgnRange*)trace->getNext();
+	}
+	if (prev) {
+		newRange->linkAfter(prev);
+	} else {
+		ranges.addToTop(newRange);
 	}
+	return true;
 }
 
 
-// Messages will be passed in for us to peruse. We'll filter out ones specifically for
-// ourselves and deal with them here. We'll return true if we dealt with the message.
-// Actually the only things we respond to are flow control messages. Anything else we'll
-// ignore.
-bool outgoingPeerToPeer::handleMsg(message* inMsg) {
+// Binary search for the first entry with this PGN.
+int pgnIndex::findFirst(uint32_t PGN) {
 
-	bool 	handled;
-	bool	dataDone;
+	int	lo;
+	int	hi;
+	int	mid;
 	
-	handled = false;											// We've done nothing yet.
-	if (isOurMsg(inMsg)) {									// Lets see if it's real and one we need to deal with.
-		switch(inMsg->getDataByte(0)) {					// Lets take a look at the control byte..
-			case  clearToSend	:								// We got a clear to send message.
-				if (ourState==waitToSend) {				// If we were waiting for a clear to send..
-					if (inMsg->getDataByte(1)==0) {		// If flagged "Need more time"..
-						xFerTimer.setTime(TH_MS,true);	// Bump up the allowed time to this much. For clear or ACK.
-					} else {										// Else it's a normal "clear to send".
-						dataDone = sendDataMsg();			// We send a data packet. (Setting local complete flag)
-						if (dataDone) {						// If that was the last data packet..
-							ourState=waitForACK;				// We're now waiting for an ACK.
-						}											//
-						xFerTimer.setTime(T3_MS,true);	// We allow this much time for clear or ACK
-					}												//
-				} else if (ourState==waitForACK) {		// If we were waiting for an ACK.. {
-					if (inMsg->getDataByte(1)==0) {		// If flagged "Need more time"..
-						xFerTimer.setTime(TH_MS,true);	// Bump up the allowed time to this much. For clear or ACK.
-					} else {													// Else this is messed up. We bail.
-						success = false;									// This is a fail.
-						complete = true;									// Crazy sauce stops the game.
-						reason = notAbort;								// We didn't get an abort. We got nonsense.
-					}															//
-				}																//
-			break;															// That should cover all those cases.
-			case  endOfMsg		:											// We got an end of message.
-				if (ourState==waitForACK) {							// If we were waiting for such a message..
-					success = true;										// Then we are successful!
-				}																//
-				complete = true;											// In every case we are completely done.
-			break;															// And that's it.
-			case  abortMsg		:											// Got an abort?!
-				complete = true;											// In every case we are done.
-				reason = valueToReason(inMsg->getDataByte(1));	// Ask them why?
-			break;															// Sigh, we failed.
-			default				:											// If we hit a default we are seriously messed up.
-				complete = true;											// In every other case we are done.
-				reason = notAbort;										// We didn't get an abort. We got nonsense.
-			break;															// Maybe we should take up knitting?
-		}																		//
-		handled = true;													// In all cases, it was our message. So we handled it.
-	} 																			//
-	return handled;														// We return our result.
+	lo = 0;
+	hi = numEntries;
+	while(lo<hi) {
+		mid = (lo+hi)/2;
+		if (entries[mid].PGN<PGN) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo<numEntries && entries[lo].PGN==PGN) return lo;
+	return -1;
 }
-						
-					
 
+
+// Both ends are inclusive. And, like everything else in here, base PGNs.
+bool pgnIndex::inRange(pgnRange* aRange,uint32_t PGN) {
+
+	return PGN>=aRange->firstPGN && PGN<=aRange->lastPGN;
+}
+
+
+// Handlers are numbered as they're added, so putting them on the end keeps these in
+// order. Grows in steps of eight, same as the entries.
+bool pgnIndex::addPlain(msgHandler* inHandler) {
+
+	msgHandler**	newPlain;
+	
+	if (!inHandler) return false;											// Sanity.
+	if (numPlain==maxPlain) {												// Full?
+		newPlain = NULL;														// resizeBuff() wants a NULL to start.
+		if (!resizeBuff(maxPlain+8,&newPlain)) return false;		// No RAM? Then no.
+		for (int i=0;i<numPlain;i++) {									// Copy over what we have..
+			newPlain[i] = plain[i];											//
+		}																			//
+		resizeBuff(0,&plain);												// Recycle the old one.
+		plain = newPlain;														// And the new one is ours.
+		maxPlain = maxPlain+8;												//
+	}																				//
+	plain[numPlain] = inHandler;											// On the end.
+	numPlain++;																	//
+	return true;
+}
+
+
+// Close up the hole, so the rest stay in order.
+void pgnIndex::dropPlain(msgHandler* inHandler) {
+
+	int	i;
+	
+	i = 0;
+	while(i<numPlain && plain[i]!=inHandler) i++;
+	if (i==numPlain) return;
+	for (;i<numPlain-1;i++) {
+		plain[i] = plain[i+1];
+	}
+	numPlain--;
+}
+
+
+
+// ***************************************************************************************
+//				     ----- filterSet. What the CAN hardware should let in. -----
+// ***************************************************************************************
+
+
+#define FILTER_PGN_MASK		0x03FFFF00	// R, DP, PF & PS. Priority and source don't matter.
+
+
+filterSet::filterSet(void) {
+
+	filters		= NULL;
+	numFilters	= 0;
+	maxFilters	= 0;
+}
+
+
+filterSet::~filterSet(void) { resizeBuff(0,&filters); }
+
+
+// Keep the RAM. We'll likely fill it right back up.
+void filterSet::clear(void) { numFilters = 0; }
+
+
+// Anything already covered by a filter we have, we skip. Anything this covers, goes.
+bool filterSet::addFilter(uint32_t id,uint32_t mask) {
+
+	canFilter	newFilter;
+	canFilter*	newFilters;
+	int			i;
+	
+	newFilter.mask	= mask & 0x1FFFFFFF;									// 29 bits is all there is.
+	newFilter.id	= id & newFilter.mask;								// Don't care bits are zero.
+	for (i=0;i<numFilters;i++) {											// Already let in?
+		if (covers(&(filters[i]),&newFilter)) return true;			// Then there's nothing to do.
+	}																				//
+	i = 0;																		// Now, anyone we'd cover..
+	while(i<numFilters) {													//
+		if (covers(&newFilter,&(filters[i]))) {						// Is redundant.
+			numFilters--;														// Drop it. Last one
+			filters[i] = filters[numFilters];							// fills the hole.
+		} else {																	//
+			i++;																	//
+		}																			//
+	}																				//
+	if (numFilters==maxFilters) {											// Full?
+		newFilters = NULL;													// Grow by eight.
+		if (!resizeBuff(maxFilters+8,&newFilters)) return false;	//
+		for (i=0;i<numFilters;i++) newFilters[i] = filters[i];	//
+		resizeBuff(0,&filters);												//
+		filters = newFilters;												//
+		maxFilters = maxFilters+8;											//
+	}																				//
+	filters[numFilters] = newFilter;										// In it goes.
+	numFilters++;																//
+	return true;
+}
+
+
+// PDU2 PGNs are sent to everyone, the whole PGN has to match. PDU1 PGNs carry the
+// destination, so we take the ones to us and the ones to everyone.
+void filterSet::addPGN(uint32_t PGN,byte ourAddr) {
+
+	PGN = basePGN(PGN);
+	if (((PGN>>8) & 0xFF)<240) {												// PDU1?
+		addFilter((PGN|ourAddr)<<8,FILTER_PGN_MASK);						// To us..
+		addFilter((PGN|GLOBAL_ADDR)<<8,FILTER_PGN_MASK);				// And to everyone.
+	} else {																			// PDU2.
+		addFilter(PGN<<8,FILTER_PGN_MASK);									// Just the PGN.
+	}
+}
+
+
+// The bits first and last have in common, the rest are don't care. This lets in the whole
+// range, and maybe some around it. A PDU1 range, we don't try to sort out destinations.
+void filterSet::addRange(uint32_t firstPGN,uint32_t lastPGN) {
+
+	uint32_t	diff;
+	uint32_t	mask;
 	
-// During break time, we'll check to see if the timer's run out. If so? The message failed
-// to complete.
-void outgoingPeerToPeer::idleTime(void) {
-	
-	if (!complete) {					// If we're still running..
-		if (xFerTimer.ding()) {		// If the timer ran out, there was no response..
-			reason = timoutAbort;	// We have a timeout failure.
-			complete = true;			// I have failed! Kill me now!
-		}
-	}
+	diff = (firstPGN ^ lastPGN) & 0x3FFFF;									// Where they differ..
+	mask = 0x3FFFF;																// Everything from the
+	while(diff) {																	// highest different bit
+		mask = (mask<<1) & 0x3FFFF;											// on down is don't care.
+		diff = diff>>1;															//
+	}																					//
+	if ((((firstPGN>>8) & 0xFF)<240) && (mask & 0xFF)) {				// PDU1, destination in there?
+		mask = mask & 0x3FF00;													// Don't care who it's to.
+	}																					//
+	addFilter(firstPGN<<8,mask<<8);
 }
 
 
+void filterSet::acceptAll(void) {
 
-//				          -----    incomingBroadcast    -----
+	clear();
+	addFilter(0,0);
+}
 
 
-// We are being created to handle an incoming broadcast. Let's get to it.
-incomingBroadcast::incomingBroadcast(message* inMsg,netObj* inNetObj,xferList* inList)
-	: xferNode(inNetObj,inList) {
+// Greedy. Find the two filters that, merged, keep the most mask bits. Merge them. Repeat
+// 'till we fit. There's never more than a few dozen of these so the brute force is fine.
+void filterSet::reduce(int inMaxFilters) {
 
-	msgSize	= pack16(inMsg->getDataByte(2),inMsg->getDataByte(1));	// Grab the number of bytes.
-	if (resizeBuff(msgSize,&msgData)) {											// If we got the RAM.
-		saveFCID(inMsg);													// Save off the PGN for later.
-		msgPacks = inMsg->getDataByte(3);										// Grab the number of packets.
-		msgAddr = inMsg->getSourceAddr();										// Grab source address.
-		xFerTimer.setTime(BCAST_T1_MS);											// We start the timeout timer.
-		complete = false;																// Clear the complete flag, were running!
-	} else {																				// Oh ohh, ran outta' RAM.
-		reason = resourceAbort;														// Failed to get the RAM.
-		success = false;																// So we failed.
-		complete = true;																// And we're done.
+	canFilter	aMerge;
+	int			bestA;
+	int			bestB;
+	int			bestBits;
+	int			bits;
+	
+	if (inMaxFilters<=0) return;												// No limit? Done.
+	while(numFilters>inMaxFilters) {										// While we have too many..
+		bestA		= 0;															//
+		bestB		= 1;															//
+		bestBits	= -1;															//
+		for (int a=0;a<numFilters-1;a++) {								// Every pair..
+			for (int b=a+1;b<numFilters;b++) {							//
+				aMerge = merged(&(filters[a]),&(filters[b]));		// What would it cost?
+				bits = countBits(aMerge.mask);							// Bits we'd still check.
+				if (bits>bestBits) {											// Best so far?
+					bestBits = bits;											// Save it.
+					bestA = a;													//
+					bestB = b;													//
+				}																	//
+			}																		//
+		}																			//
+		aMerge = merged(&(filters[bestA]),&(filters[bestB]));		// The winner.
+		numFilters--;															// Lose b, last one
+		filters[bestB] = filters[numFilters];							// fills the hole.
+		numFilters--;															// Lose a, the same way.
+		filters[bestA] = filters[numFilters];							//
+		addFilter(aMerge.id,aMerge.mask);									// Then add the merge. (Drops anything it covers.)
 	}
-}																					
+}
 
-	
-// The only thing we allocated was part of a message that'll dissolve when we recycle. So
-// nothing to do here.
-incomingBroadcast::~incomingBroadcast(void) { }
 
+// a covers b if a checks no bits b doesn't, and they agree on the bits a does check.
+bool filterSet::covers(canFilter* a,canFilter* b) {
 
-// Broadcasts run completely on timers and there is no way to control them from this end.
-bool incomingBroadcast::handleMsg(message* inMsg) {
+	if ((a->mask & b->mask)!=a->mask) return false;
+	return (a->id & a->mask)==(b->id & a->mask);
+}
 
-	int		i;
-	bool		handled;
-	message	outMsg;
+
+// Check only the bits both check, and that they agree on.
+canFilter filterSet::merged(canFilter* a,canFilter* b) {
+
+	canFilter	result;
 	
-	handled = false;														// Not handled anything yet.
-	if (isOurMsg(inMsg)) {												// If it's from our guy.															
-		i = 1;																// Fine! We'll take it. Set up a counter.
-		while(byteTotal<msgSize&&i<8) {								// While we have data to transfer and a place to store it.
-			msgData[byteTotal] = inMsg->getDataByte(i);			// We transfer bytes.
-			byteTotal++;													// Bump up the total transferred.
-			i++;																// Bump local count.
-		}																		// 
-		packNum++;															// Bump up our packet ID num.
-		if (byteTotal==msgSize) {										// If we got ALL the bytes?
-			outMsg.acceptData(msgData,msgSize);						// We hand over ownership of our data buffer.
-			msgData = NULL;												// And we flag that we no longer own that data.
-			outMsg.setPGN(xferPGN);										// Set in our saved PGN.
-			outMsg.setSourceAddr(msgAddr);							// Set in their address.
-			addMsgToQ(&outMsg);											// Add what we built to the queue.
-			success = true;												// A success!
-			complete = true;												// Call for our recycling, we're done!
-		} else {																// Else there's more? Of course there's more!
-			xFerTimer.start();											// Restart the timeout timer.
-		}																		//
-		handled = true;													// Hey, we we handled that one!
-	}																			//
-	return handled;														// Wasn't what we were looking for. Not handled.
+	result.mask	= a->mask & b->mask & ~(a->id ^ b->id);
+	result.id	= a->id & result.mask;
+	return result;
 }
 
 
-// If our timer ever expires we assume the sending node gave up.
-void incomingBroadcast::idleTime(void) {
+int filterSet::countBits(uint32_t value) {
 
-	if (!complete) {					// If we're still running..
-		if (xFerTimer.ding()) {		// And our timeout timer expires?
-			reason = timoutAbort;	// Then we ran outta' time!
-			complete = true;			// Call for our recycling, we're done!
-		}
+	int	count;
+	
+	count = 0;
+	while(value) {
+		count = count + (value & 1);
+		value = value>>1;
 	}
+	return count;
 }
 
 
 
-//				         -----    incomingPeerToPeer    -----
-
+// ***************************************************************************************
+//		----- netObj. Base class for allowing navigation of SAE J1939 networks -----
+// ***************************************************************************************
 
-incomingPeerToPeer::incomingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList)
-	: xferNode(inNetObj,inList) {
+						
+netObj::netObj(void)
+	: linkList(), idler(), netName() {
 	
-	if (inMsg) {																					// Quick sanity.
-		if (inMsg->getPDUf()==SEND_REQ) {													// Peer to peer, we only have the PDUf to go on.
-			if (inMsg->getPDUs()==inNetObj->getAddr()) {									// It's ours.
-				msgSize	= pack16(inMsg->getDataByte(2),inMsg->getDataByte(1));	// Grab the number of bytes.
-				if (resizeBuff(msgSize,&msgData)) {											// See if we can get the RAM.
-					saveFCID(inMsg);													// Grab PGN to be used later.
-					msgAddr = inMsg->getSourceAddr();										// Grab return addr.
-					msgPacks = inMsg->getDataByte(3);										// Grab the number of packets.
-					sendflowControlMsg(clearToSend);											// Tell 'em it's ok, send the data.
-					xFerTimer.setTime(T2_MS);													// We start the timeout timer.
-					complete = false;																// Clear the complete flag. We're running!
-				} else {																				// Else we couldn't get the RAM?
-					sendflowControlMsg(abortMsg,resourceAbort);							// Send an abort message.
-					reason = resourceAbort;														// Note we ran outta' RAM.
-					complete = true;																// And tell 'em to dump us off the list. Ain't going to work.
-				}
-			}
-		}
-	}
+	ourState	= config;		// We arrive in config mode.
+	addr		= NULL_ADDR;	// No address.
+	handlerSeq	= 0;			// No handlers yet.
+	dispatchNum	= 0;			// No messages handed out yet.
+	ourRouter	= NULL;		// No compiled in handlers.
+	routerContext	= NULL;	//
+	ourSignals	= NULL;		// No last value store.
+	numFast		= 0;			// Nothing in the fast lane.
+	filterLimit	= RX_FILTER_MAX;	// What the hardware can take.
+	rxMaxMsgs	= RX_DRAIN_MSGS;	// How much incoming we chew on per idle().
+	rxMaxUs		= RX_DRAIN_US;		//
+	holdTimer.reset();		// Shut down the timers so we don't get false triggers.
+	arbitTimer.reset();		//
+	claimTimer.reset();		//
 }
 
-	
 
-// We attempted to allocate the message buffer. If we failed at some point it might be
-// laying about wasted RAM. If so, lets recycle it. If it's null, then either someone took
-// it over or we never allocated it. Either way, this'll do the right thing.
-incomingPeerToPeer::~incomingPeerToPeer(void) { resizeBuff(0,&msgData); }
+// Destructor. I don't think there's anything that's not handled automatically.
+netObj::~netObj(void) {  }
 
 
-// We can get data packets or flow control packets.
-bool incomingPeerToPeer::handleMsg(message* inMsg) {
+// Things we can do to set up shop once we are actually post globals and running in code.
+void netObj::begin(byte inAddr,addrCat inAddrCat) {
 
-	int		i;
-	bool		handled;
-	message	outMsg;
-	
-	handled = false;															// Well, we haven't handled anything yet.
-	if (isOurMsg(inMsg)) {													// Is this message ours ans in good shape?																			
-		if (inMsg->getPDUf()==DATA_XFER_PF) {							// If it's a data packet..
-			i = 1;																// Fine! We'll take it. Set up a counter.
-			while(byteTotal<msgSize&&i<8) {								// While we have data to transfer and a place to store it.
-				msgData[byteTotal] = inMsg->getDataByte(i);			// We transfer bytes.
-				byteTotal++;													// Bump up the total transferred.
-				i++;																// Bump local count.
-			}																		// 
-			packNum++;															// Bump up our packet ID num.
-			if (byteTotal==msgSize) {										// If we got 'em all..
-				outMsg.acceptData(msgData,msgSize);						// We hand over ownership of our data buffer.
-				msgData = NULL;												// And we flag that we no longer own that data.
-				outMsg.setPGN(xferPGN);										// Set in our saved PGN.
-				outMsg.setSourceAddr(msgAddr);							// Set in their address.
-				addMsgToQ(&outMsg);											// Add what we built to the queue.
-				success = true;												// A success!
-				complete = true;												// Call for our recycling, we're done!
-				sendflowControlMsg(endOfMsg);								// Tell 'em we got it all.
-			} else if (byteTotal<msgSize) {								// Else there's more coming..
-				sendflowControlMsg(clearToSend);							// Tell 'em to send more.
-				xFerTimer.setTime(T2_MS);									// We start the timeout timer.
-			} else {
-				reason = notAbort;											// Missed the ending somehow.
-				success = false;												// A fail.
-				complete = true;												// We missed the data count. Abort!!
-				sendflowControlMsg(abortMsg);								// Tell 'em
-			}													
-			handled = true;													// We handled this message.
-		} else if (inMsg->getPDUf()==FLOW_CON_PF) {					// Or, if it's a flow control msg..
-			
-			switch(inMsg->getDataByte(0)) {								// Let's see what they sent us.
-				case reqToSend		:											// Umm, we're receiving, not sending.
-				case clearToSend	:											// Same as above.
-				case BAM				:											// Whoa! This is peer to peer..
-					reason = notAbort;										// We didn't get an abort. They went nuts!
-					success = false;											// A fail.
-					complete = true;											// Each case is crazy sauce. Pull the plug!
-				break;															// Enough!
-				case abortMsg		:											// Abort is valid.
-					reason = valueToReason(inMsg->getDataByte(1));	// We'll save their reason.
-					success = false;											// A fail.
-					complete = true;											// And we're done.
-				break;															// Jump out.
-				default				:											// We got something else?!
-					reason = notAbort;										// We didn't get an abort, they sent gibberish.
-					success = false;											// A fail.
-					complete = true;											// Again it's crazy sauce. Pull the plug!
-				break;															//
-			}																		//
-			handled = true;													// We handled this message.				   
-		}
-	}		
-	return handled;
+	ourXferList.begin(this);				// The xferList needs a pointer to us. Here 'tis.
+	setAddrCat(inAddrCat);					// Our method of handling address issues.
+	setAddr(inAddr);							// Our initial address. (Sets up the filters, too.)
+	hookup();									// We are guaranteed to be in code section, so hookup.
+	ourXferList.hookup();					// That should do it..
 }
 
 
-// Idle in this case is basically a deadman switch. If the timer expires, the connection was lost.
-void incomingPeerToPeer::idleTime(void) {
+// Add the handlers of the messages you would like to send/receive. They go on the end, so
+// the list is in the order they were added. That's the order they're called in.
+void netObj::addMsgHandler(msgHandler* inHanldler) {
 
-	if (!complete && xFerTimer.ding()) {	// If the timer expires while still working..
-		reason = timoutAbort;
-		complete = true;							// Give up. The other side dropped connection.
+	if (!inHanldler) return;						// NULL pointers will be filtered out.
+	handlerSeq++;										// Next number..
+	inHanldler->regSeq = handlerSeq;				// Is theirs.
+	addToEnd(inHanldler);							// Hope it's a good one.
+	if (!inHanldler->indexed) {					// Not said what it wants?
+		ourPGNIndex.addPlain(inHanldler);		// Then it gets everything.
 	}
+	rebuildFilters();									// They may want more let in.
 }
 
 
+// Add a handler that only wants this PGN. Call it again for each PGN it wants, it's only
+// put on the list the once. From then on it's only handed messages of the PGNs it asked
+// for. And it's found by looking the PGN up, not by asking every handler we have.
+void netObj::addMsgHandler(msgHandler* inHanldler,uint32_t PGN) {
 
-//				            -----    xferList    -----
+	if (!inHanldler) return;											// Sanity.
+	if (!haveHandler(inHanldler)) addMsgHandler(inHanldler);	// On the list for idleTime() and such.
+	if (!inHanldler->indexed) {										// Was it getting everything?
+		ourPGNIndex.dropPlain(inHanldler);							// Not anymore.
+		inHanldler->indexed = true;									// It's picky now.
+	}																			//
+	ourPGNIndex.addPGN(PGN,inHanldler);								// And this is what it wants.
+	rebuildFilters();														// Let it in.
+}
 
 
-xferList::xferList(void)
-	: linkList(), idler() { ourNetObj = NULL; }
-	
-	
-xferList::~xferList(void) {  }
+// Same, but a range of PGNs, first to last. Good for proprietary blocks and the like.
+void netObj::addMsgHandler(msgHandler* inHanldler,uint32_t firstPGN,uint32_t lastPGN) {
 
+	if (!inHanldler) return;
+	if (!haveHandler(inHanldler)) addMsgHandler(inHanldler);
+	if (!inHanldler->indexed) {
+		ourPGNIndex.dropPlain(inHanldler);
+		inHanldler->indexed = true;
+	}
+	ourPGNIndex.addRange(basePGN(firstPGN),basePGN(lastPGN),inHanldler);
+	rebuildFilters();
+}
 
-void xferList::begin(netObj* inNetObj) { ourNetObj = inNetObj; }
 
+// Compiled in handlers. A router gets every message before the handlers on our list do.
+void netObj::setRouter(routeFunc inRouter,void* context) {
 
-// Either we create a new outgoing extended message. Or, we received from the net a new
-// incoming extended message. Create the suitable handler node with the initial message
-// that started it. Then, add this new node to the xferNode list.
-void xferList::addXfer(message* ioMsg,xferTypes xferType) {
+	ourRouter		= inRouter;
+	routerContext	= context;
+	rebuildFilters();
+}
 
-	xferNode*	newXferNode;
+
+// A router's handlers can't tell us their PGNs. So tell us here, one call per PGN. 'Till
+// you do, with a router hooked up, the filters let everything in.
+void netObj::addFilterPGN(uint32_t PGN) {
+
+	pgnRange*	newPGN;
 	
-	newXferNode = NULL;
-	switch(xferType) {
-		case broadcastIn		:	// We received a "BAM message".
-			newXferNode = (xferNode*) new incomingBroadcast(ioMsg,ourNetObj,this);
-		break;
-		case broadcastOut		:	// We created a "BAM message".
-			newXferNode = (xferNode*) new outgoingBroadcast(ioMsg,ourNetObj,this);
-		break;
-		case peerToPeerIn		:	// We received a "request to send" from a peer.
-			newXferNode = (xferNode*) new incomingPeerToPeer(ioMsg,ourNetObj,this);
-		break;
-		case peerToPeerOut	:	// We created a "request to send" for a peer.
-			newXferNode = (xferNode*) new outgoingPeerToPeer(ioMsg,ourNetObj,this);
-		break;
-	}
-	if (newXferNode) {
-		addToTop(newXferNode);
+	PGN = basePGN(PGN);
+	newPGN = new pgnRange(PGN,PGN,NULL);
+	if (newPGN) {
+		extraFilterPGNs.addToEnd(newPGN);
+		rebuildFilters();
 	}
 }
 
 
+void netObj::setFilterLimit(int maxFilters) {
 
-bool xferList::checkList(message* ioMsg) {
+	if (maxFilters<0) maxFilters = 0;
+	filterLimit = maxFilters;
+	rebuildFilters();
+}
 
-	bool			handled;
-	xferNode*	trace;
-	
-	handled = false;													// Assume we don't handle this.
-	trace = (xferNode*)getFirst();								// Grab first handler node from the list.
-	while(trace && !handled) {										// While we have non NULL node. AND message has not been handled..
-		handled = trace->handleMsg(ioMsg);						// Ask each node if they want/need to handle this message.
-		trace = (xferNode*)trace->getNext();					// Then grab the next node regardless of the answer.
-	}
-	return handled;
-}	
 
+int netObj::getNumFilters(void) { return ourFilters.numFilters; }
 
-// Ok, a message has come in from either the net, OR, we wrote it. It could be a start of
-// a transfer we need to deal with. It could be part of a message we are already dealing
-// with. Most likely it's nothing that concerns us. But, we get first right of refusal. So
-// lets have a look at it.
-bool xferList::handleMsg(message* ioMsg,bool received) {
 
+// Past the end? You get one that lets everything in.
+canFilter netObj::getFilter(int index) {
+
+	canFilter	allIn;
 	
-	bool			handled;
-	message		tempMsg;
-	uint32_t		PGN;
-	
-	handled = false;																		// Ain't handled nuthin' yet.
-	if (ioMsg) {																			// Sanity, check we got something.
-		if (received) {																	// From the network!
-			if (ioMsg->getPDUf()==FLOW_CON_PF) {									// If it's an incoming TP message..
-				switch((int)ioMsg->getDataByte(0)) {
-					case reqToSend		:													// REQUEST TO SEND : New Peer to peer incoming.
-						PGN = ioMsg->getData5PGN();									// Lets see what this TP is all about.
-						tempMsg.setPGN(PGN);												// Drop this PGN into our temp message so we can..
-						if (!tempMsg.isBroadcast()) {									// See if the multi packet message is peer to peer..
-							if (tempMsg.getPDUs()==ourNetObj->addr) {				// And it's to us.
-								addXfer(ioMsg,peerToPeerIn);							// Setup a brodcast transfer.
-								handled = true;											//	This message has been handled!
-							}																	//
-						}																		// 	
-					break;																	//
-					case clearToSend	: handled = checkList(ioMsg); break;	// CLEAR TO SEND : Hand it to the list, done.
-					case endOfMsg		: handled = checkList(ioMsg); break;	// END OF MESSAGE : Hand it to the list, done.
-					case BAM				: 													// BROADCAST ANNOUNCE MESSGE : New broadcast incoming.
-						PGN = ioMsg->getData5PGN();									// Lets see what this TP is all about.
-						tempMsg.setPGN(PGN);												// Drop this PGN into our temp message so we can..
-						if (tempMsg.isBroadcast()) {									// See if the multi packet message actually is a broadcast..
-							addXfer(ioMsg,broadcastIn);								// Setup a brodcast transfer.
-							handled = true;												//	And this message has been handled!
-						}																		//
-					break;																	//
-					case abortMsg		: handled = checkList(ioMsg); break;	// ABORT MESSGE : Hand it to the list, done.
-				}																				//
-			} else if (ioMsg->getPDUf()==DATA_XFER_PF) {							// DATA TRANSFER MESSGE : An incoming dats packet..
-				handled = checkList(ioMsg);											// Hand it to the list, done.
-			}																					//
-		} else if (ioMsg->getNumBytes()>8) {										// Else if WE wrote an oversized message..
-			if (ioMsg->isBroadcast()) {												// If the message itself is a broadcast..
-				addXfer(ioMsg,broadcastOut);											// Setup a multi packet brodcast transfer.
-			} else {																			// Else it's NOT a broadcast..
-				addXfer(ioMsg,peerToPeerOut);											// Set up a multi packet peer to peer transfer.
-			}																					//
-			handled = true;																// In any case, it's been handled.
-		}																						//		
-	}																							//
-	return handled;																		// And we return our result.
+	if (index>=0 && index<ourFilters.numFilters) return ourFilters.filters[index];
+	allIn.id		= 0;
+	allIn.mask	= 0;
+	return allIn;
 }
 
 
-// Is there a transfer node that's currently waiting on anything?
-bool xferList::anyoneWaiting(void) {
+// Everything we need to hear, ourselves, to keep the network running. Then whatever the
+// handlers asked for. Squeeze it down to what the hardware can hold, and let the driver
+// know.
+void netObj::rebuildFilters(void) {
 
-	xferNode*	trace;
+	pgnRange*	range;
+	bool			wantAll;
 	
-	trace = (xferNode*)getFirst();							// Grab the pointer to the top of the list.
-	while(trace) {													// While we don't have a null pointer..
-		if (!trace->complete) {									// If this node is still running..
-			if (trace->xFerTimer.getFraction()!=100) {	// If it's currently busy.
-				return true;										// Found a busy one! Return true.
-			}															// If this node was NOT complete..
-		}																//
-		trace = (xferNode*)trace->getNext();				// We jump to the next. (Till we hit a null pointer.)
-	}																	//
-	return false;													// I guess no one is busy. Return false.
+	wantAll = ourRouter && !extraFilterPGNs.getFirst();					// A router that hasn't told us what it wants?
+	if (ourPGNIndex.numPlain>0) wantAll = true;								// Or a handler that didn't say? Then it's everything.
+	if (wantAll) {																		// Everything?
+		ourFilters.acceptAll();														// Easy.
+	} else {																				// Else, work it out..
+		ourFilters.clear();															//
+		ourFilters.addPGN(ADDR_CLAIMED,addr);										// The network.
+		ourFilters.addPGN(REQ_MESSAGE,addr);										//
+		ourFilters.addPGN(ACKNOWLEDGE_PGN,addr);									//
+		ourFilters.addPGN(COMMAND_ADDR,addr);										//
+		ourFilters.addPGN(BAM_COMMAND,addr);										// Transport, all kinds.
+		ourFilters.addPGN(DATA_XFER,addr);											//
+		ourFilters.addPGN(ETP_FLOW_CON,addr);										//
+		ourFilters.addPGN(ETP_DATA_XFER,addr);										//
+		for (int i=0;i<ourPGNIndex.numEntries;i++) {							// Handlers' PGNs.
+			ourFilters.addPGN(ourPGNIndex.entries[i].PGN,addr);				//
+		}																					//
+		range = (pgnRange*)ourPGNIndex.ranges.getFirst();						// Their ranges.
+		while(range) {																	//
+			ourFilters.addRange(range->firstPGN,range->lastPGN);				//
+			range = (pgnRange*)range->getNext();									//
+		}																					//
+		range = (pgnRange*)extraFilterPGNs.getFirst();							// And the extras.
+		while(range) {																	//
+			ourFilters.addPGN(range->firstPGN,addr);								//
+			range = (pgnRange*)range->getNext();									//
+		}																					//
+		for (int i=0;i<numFast;i++) {													// The fast lane.
+			ourFilters.addPGN(fastLane[i].PGN,addr);								//
+		}																					//
+		ourFilters.reduce(filterLimit);												// Make it fit.
+	}																						//
+	filtersChanged();																	// Tell the driver.
 }
 
 
-// Basic garbage collection. Any transfer message nodes completed get marked as complete
-// and need to be recycled. Actually we only need to kill off one. This will be called
-// over and over so, if there are more, the'll get hit soon.
-void  xferList::listCleanup(void) {
+// Fill this in to load getFilter(0..getNumFilters()-1) into your CAN controller. Called
+// every time the set changes. Default does nothing, so everything gets in.
+void netObj::filtersChanged(void) {  }
 
-	xferNode*	trace;
+
+bool netObj::haveHandler(msgHandler* inHanldler) {
+
+	linkListObj*	trace;
 	
-	trace = (xferNode*)getFirst();					// Grab the pointer to the top of the list.
-	while(trace) {											// While we don't have a null pointer..
-		if (trace->complete) {							// If this node is complete..
-			unlinkObj(trace);								// Unlink the node.
-			delete(trace);									// Recycle the node.
-			trace = NULL;									// One node killing is enough. Null out the pointer.
-		} else {												// If this node was NOT complete..
-			trace = (xferNode*)trace->getNext();	// We jump to the next. (Till we hit a null pointer.)
-		}
-	}	
+	trace = getFirst();
+	while(trace) {
+		if (trace==inHanldler) return true;
+		trace = trace->getNext();
+	}
+	return false;
 }
 
 
-// Maintain the list and let all the current transfers do their thing.
-void  xferList::idle(void) {
+// Big incoming transfers you'd rather have streamed to you, or written straight into your
+// own buffer. See xferSink.
+void netObj::addXferSink(xferSink* inSink) { ourXferList.addSink(inSink); }
+
+
+// All incoming transfers together get this much RAM to reassemble into. Zero for no limit.
+void netObj::setRxBudget(uint32_t numBytes) { ourXferList.setRxBudget(numBytes); }
+
 
-	xferNode*	trace;
-	
-	listCleanup();										// If we can find a completed node, we'll recycle it.
-	trace = (xferNode*)getFirst();				// Grab pointer to top of list.
-	while(trace) {										// While we don't have a null pointer..
-		trace->idleTime();							// Give each node some time to do stuff.
-		trace = (xferNode*)trace->getNext();	// We jump to the next node. (Till we hit a null pointer.)
-	}
-}
+// When there's not enough RAM to go around, more important transfers get it first.
+void netObj::setXferPriority(uint32_t PGN,uint8_t prio) { ourXferList.setPriority(PGN,prio); }
 
 
+// When our handlers fall behind, peer to peer senders are held 'till we catch up.
+void netObj::setRxHighWater(int numMsgs,uint32_t numBytes) { ourXferList.setHighWater(numMsgs,numBytes); }
 
-// ***************************************************************************************
-//				              ----- mesgQ. Hold 'em in here. -----
-// ***************************************************************************************
 
+// Outgoing broadcasts go one at a time, one packet every this many ms.
+void netObj::setBAMGap(int ms) { ourXferList.setBAMGap(ms); }
 
-msgObj::msgObj(message* inMsg)
-	: linkListObj(),
-	message(inMsg) {  }
 
+// Outgoing peer to peer data packets, one every this many ms.
+void netObj::setP2PGap(int ms) { ourXferList.setP2PGap(ms); }
 
-msgObj::~msgObj(void) { }					
-					
 
-msgQ::msgQ(void) {  }
+// Or, this PGN gets its own gap. -1 to go back to the default.
+void netObj::setTxGap(uint32_t PGN,int ms) { ourXferList.setTxGap(PGN,ms); }
 
 
-msgQ::~msgQ(void) {  }
+// On a closed segment? Broadcasts can go faster than J1939 allows.
+void netObj::setFastPacing(bool onOff) { ourXferList.setFastPacing(onOff); }
 
 
+// How long 'till an outgoing data packet is due? -1, nothing's waiting.
+long netObj::nextTxMs(void) { return ourXferList.nextTxMs(); }
 
-// ***************************************************************************************
-//		----- netObj. Base class for allowing navigation of SAE J1939 networks -----
-// ***************************************************************************************
 
-						
-netObj::netObj(void)
-	: linkList(), idler(), netName() {
-	
-	ourState	= config;		// We arrive in config mode.
-	addr		= NULL_ADDR;	// No address.
-	holdTimer.reset();		// Shut down the timers so we don't get false triggers.
-	arbitTimer.reset();		//
-	claimTimer.reset();		//
-}
+// Send any data packets that are due. Call this as often as you like for tight spacing.
+void netObj::serviceTx(void) { ourXferList.serviceTx(); }
 
 
-// Destructor. I don't think there's anything that's not handled automatically.
-netObj::~netObj(void) {  }
+// How outgoing peer to peer transfers retry when the other end's busy or doesn't answer.
+void netObj::setRetry(xferRetry* inRetry) { ourXferList.setRetry(inRetry); }
 
 
-// Things we can do to set up shop once we are actually post globals and running in code.
-void netObj::begin(byte inAddr,addrCat inAddrCat) {
+// Or, how this PGN's transfers do. NULL to go back to the default.
+void netObj::setRetry(uint32_t PGN,xferRetry* inRetry) { ourXferList.setRetry(PGN,inRetry); }
 
-	ourXferList.begin(this);				// The xferList needs a pointer to us. Here 'tis.
-	setAddr(inAddr);							// Our initial address.
-	setAddrCat(inAddrCat);					// Our method of handling address issues.
-	hookup();									// We are guaranteed to be in code section, so hookup.
-	ourXferList.hookup();					// That should do it..
-}
 
+// How fast is our bus? The bandwidth shares are percents of this.
+void netObj::setBusRate(uint32_t bitsPerSec) { ourBandwidth.setBusRate(bitsPerSec); }
+
+
+// What percent of the bus a class of frames can have. Only transport and bulk data packets
+// are ever held back. Zero means no limit.
+void netObj::setBandwidth(bwClass aClass,uint8_t percent) { ourBandwidth.setShare(aClass,percent); }
 
-// Add the handlers of the messages you would like to send/receive.
-void netObj::addMsgHandler(msgHandler* inHanldler) {
 
-	addToTop(inHanldler);	// Hope it's a good one. NULL pointers will be filtered out.
+// Per source address, how many incoming transfers can run at once and how many they can
+// start in windowMs. Zero turns either off.
+void netObj::setSourceLimits(int maxSessions,int maxAnnounce,int windowMs) {
+
+	ourXferList.setSourceLimits(maxSessions,maxAnnounce,windowMs);
 }
 
 
+// Counters for one source. NULL if they've never started a transfer with us.
+sourceStats* netObj::getSourceStats(byte srcAddr) { return ourXferList.findSource(srcAddr); }
+
+
 // When a message comes in from the net, pass it in here. -(8 or less data bytes)- For now
 // we just stuff it into the incoming message queue. During idle time we'll grab messages
 // out of that queue and deal with them or pass them on to the user's handlers.
 void netObj::incomingMsg(message* inMsg) {
 
-	msgObj*	newMsg;
+	msgObj*		newMsg;
+	frameClass	aClass;
 	
-	if (inMsg) {												// First sanity. Did they slip us a NULL?
-		if (!ourXferList.handleMsg(inMsg,true)) {		// Not NULL. Ok, if the xfer list doesn't want it..
-			newMsg = new msgObj(inMsg);					// Make up a msgObj..
-			if (newMsg) {										// Got one?
-				ourMsgQ.push(newMsg);						// Stuff it into the queue.
-			}
-		}
+	if (!inMsg) return;										// First sanity. Did they slip us a NULL?
+	aClass = inMsg->getClass();							// What kind is it? We only ask the once.
+	switch(aClass) {											// Transport goes to the xfer list.
+		case tpConFrame	:									// Connection management..
+		case tpDataFrame	:									// Or data packets.
+			if (ourXferList.handleMsg(inMsg,true)) return;	// If it took it, we're done.
+		break;													// Else it's queued like anything else.
+		case appFrame		:									// Application data..
+			if (ourMsgQ.coalesce(inMsg)) return;		// Newer copy of one that's waiting? Then we're done.
+		break;													//
+		default				: break;							// Control, straight in the queue.
+	}																//
+	newMsg = new msgObj(inMsg,aClass,isForUs(inMsg));	// Make up a msgObj..
+	if (newMsg) {												// Got one?
+		ourMsgQ.push(newMsg);								// Stuff it into the queue.
+	}
+}
+
+
+// The interrupt safe way in. No heap, no lists, just a copy into the receive ring. The
+// frames are fed through incomingMsg() later, from idle(). Call this from your driver's
+// receive interrupt or thread. Returns false if the ring was full and the frame was lost.
+// Fast lane PGNs go to their fastHandlers first, right now. (See fastHandler)
+bool netObj::rxFrame(uint32_t CANID,uint8_t numBytes,const uint8_t* data) {
+
+	if (numFast && checkFastLane(CANID,numBytes,data)) return true;	// Dealt with right here?
+	return ourRxRing.put(CANID,numBytes,data);								// Else it waits for idle().
+}
+
+
+// Put a handler in the fast lane for this PGN. Call again for each PGN it wants. The entry
+// is filled in before it's counted, so an interrupt never sees half of one.
+bool netObj::addFastHandler(fastHandler* inHandler,uint32_t PGN) {
+
+	fastEntry*	entry;
+	
+	if (!inHandler || numFast>=FAST_LANE_MAX) return false;	// Sanity, and room?
+	entry = &(fastLane[numFast]);										// The next empty one.
+	entry->PGN		= basePGN(PGN);										// Fill it in.
+	entry->handler	= inHandler;											//
+	__sync_synchronize();													// All that lands before..
+	numFast = numFast+1;														// It's counted.
+	rebuildFilters();															// Let it in.
+	return true;
+}
+
+
+// Straight from the raw ID. No message, no heap. PDU1 frames have to be for us or everyone.
+// Everyone in the fast lane for the PGN gets it. If any of them took it, true.
+bool netObj::checkFastLane(uint32_t CANID,uint8_t numBytes,const uint8_t* data) {
+
+	uint32_t	PGN;
+	byte		PDUs;
+	bool		taken;
+	uint8_t	count;
+	
+	PGN = (CANID>>8) & 0x3FFFF;											// R, DP, PDUf, PDUs.
+	if (((PGN>>8) & 0xFF)<240) {											// PDU1?
+		PDUs = PGN & 0xFF;													// Who's it to?
+		if (PDUs!=addr && PDUs!=GLOBAL_ADDR) return false;			// Not us, not our business.
+		PGN = PGN & 0x3FF00;													// Lose the destination.
+	}																				//
+	if (numBytes>8) numBytes = 8;											// CAN frames don't get bigger.
+	taken = false;																// No one's taken it yet.
+	count = numFast;															// Only these are ready.
+	__sync_synchronize();													// See them as they were when count moved.
+	for (uint8_t i=0;i<count;i++) {										// Anyone want it?
+		if (fastLane[i].PGN==PGN) {										// This one does..
+			if (fastLane[i].handler->fastFrame(PGN,CANID & 0xFF,numBytes,data)) {
+				taken = true;													// And took it.
+			}																		//
+		}																			//
+	}																				//
+	return taken;
+}
+
+
+uint32_t netObj::getRxOverflows(void) { return ourRxRing.getOverflows(); }
+
+
+// Feed whatever the receive ring has into incomingMsg(). The one message carries all of
+// them, so it's not a trip to the heap for every frame.
+void netObj::checkRxRing(void) {
+
+	message	aFrame(0);							// Starts empty. Costs nothing 'till a frame shows up.
+	
+	while(ourRxRing.get(&aFrame)) {		// While there's frames waiting..
+		incomingMsg(&aFrame);				// In they go, oldest first.
 	}
 }
 
@@ -1829,12 +4855,36 @@ void netObj::outgoingingMsg(message* outMsg) {
 		if (outMsg->getNumBytes()>8) {				// Ok, If we have more than 8 databytes..
 			ourXferList.handleMsg(outMsg,false);	// Pass the message over to the xfer list.
 		} else {												// Else, we are within 8 data bytes limit..
+			ourBandwidth.charge(outMsg);				// Count it against its share of the bus.
 			sendMsg(outMsg);								// Shove the message out the wire.
 		}
 	}
 }
 
 
+// Same as outgoingingMsg(), but the handle tells you how it went. Small messages are done
+// right here. Big ones, the transfer takes the handle and fills it in when it's over.
+bool netObj::sendXfer(message* inMsg,xferHandle* inHandle) {
+
+	if (!inMsg || !inHandle) return false;							// Sanity.
+	if (inHandle->state==xferHandle::handleRunning) return false;	// Already busy with something.
+	inHandle->begin(inMsg->getNumBytes());							// Off we go.
+	if (inMsg->getNumBytes()<=8) {									// Small, one frame.
+		ourBandwidth.charge(inMsg);									// Count it.
+		sendMsg(inMsg);													// Out it goes.
+		inHandle->finish(true,notAbort,inMsg->getNumBytes());	// And that's that.
+		return true;														//
+	}																			//
+	ourXferList.nextHandle = inHandle;								// Whoever's created next gets this.
+	ourXferList.handleMsg(inMsg,false);								// Pass it over to the xfer list.
+	if (ourXferList.nextHandle) {										// Still here? No one took it.
+		ourXferList.nextHandle = NULL;								// Clear it out.
+		inHandle->finish(false,noReason,0);							// Couldn't even start. (Too big for broadcast?)
+	}
+	return true;
+}
+
+
 // Fire off a process and this should give you a good idea when it's done.
 bool netObj::isBusy() {
 
@@ -1862,60 +4912,203 @@ void netObj::refreshAddrList(void) {
 }
 
 
+// Hand this message to everyone who wants it. Each handler gets it once, in the order
+// they were added. true if any of them claimed it.
+//
+// Requests are a little different. The handlers that want the requested PGN are the
+// ones that make it, so they get the request. Then any that want requests in general.
+//
+// If there's a router, it goes first. It sees requests by the requested PGN only.
+//
+// isRequest is what isRequestMsg() says about it. The queue has that worked out already,
+// so it's passed in rather than asked again.
+bool netObj::dispatchMsg(message* inMsg,bool isRequest) {
+
+	uint32_t	PGN;
+	bool		claimed;
+	
+	claimed = false;																		// No claims yet.
+	dispatchNum++;																			// New message, new number.
+	if (isRequest) {																		// A request?
+		PGN = basePGN(getRequestPGN(inMsg));											// It goes by what it's asking for.
+	} else {																					// Everything else..
+		PGN = basePGN(inMsg->getPGN());												// Goes by its own PGN.
+	}																							//
+	if (ourRouter) {																		// Compiled in handlers?
+		claimed = ourRouter(routerContext,inMsg,PGN);							// They go first.
+	}																							//
+	if (dispatchPGN(inMsg,PGN,true)) claimed = true;									// Then the handlers on our list.
+	if (isRequest) {																		// And if it was a request..
+		if (dispatchPGN(inMsg,basePGN(REQ_MESSAGE),false)) claimed = true;		// Those that watch requests.
+	}																							//
+	return claimed;
+}
+
+
+// Three places to find handlers. The ones that asked for this PGN, found with a quick look
+// up. Those that asked for a range covering it. And the ones that didn't say what they
+// want. All three lists are in the order the handlers were added, so we walk all three
+// at once, always calling the earliest added next. Anyone already handed this message,
+// say they're in two lists, is skipped. A second pass for the same message can leave off
+// withPlain, the ones that didn't say have already had it.
+bool netObj::dispatchPGN(message* inMsg,uint32_t PGN,bool withPlain) {
+
+	msgHandler*	trace;
+	msgHandler*	next;
+	pgnRange*	range;
+	int			i;
+	int			p;
+	int			numEntries;
+	int			numPlain;
+	bool			claimed;
+	
+	claimed		= false;																// No claims yet.
+	numEntries	= ourPGNIndex.numEntries;											//
+	i = ourPGNIndex.findFirst(PGN);													// Anyone ask for it?
+	if (i<0) i = numEntries;															// No? Then that list's done.
+	range = (pgnRange*)ourPGNIndex.ranges.getFirst();							// Start of the ranges.
+	numPlain = 0;																			// And the ones that didn't say.
+	if (withPlain) numPlain = ourPGNIndex.numPlain;								//
+	p = 0;																					//
+	do {
+		if (i<numEntries && ourPGNIndex.entries[i].PGN!=PGN) i = numEntries;	// Ran past our PGN? Done with those.
+		while(range && !ourPGNIndex.inRange(range,PGN)) {						// Skip ranges that don't cover us.
+			range = (pgnRange*)range->getNext();									//
+		}																						//
+		trace = NULL;																		//
+		if (p<numPlain) trace = ourPGNIndex.plain[p];								//
+		next = NULL;																		// Now, who's earliest?
+		if (i<numEntries) next = ourPGNIndex.entries[i].handler;				//
+		if (range && (!next || range->handler->regSeq<next->regSeq)) {		//
+			next = range->handler;														//
+		}																						//
+		if (trace && (!next || trace->regSeq<next->regSeq)) next = trace;	//
+		if (next) {																			// Got one.
+			if (i<numEntries && ourPGNIndex.entries[i].handler==next) i++;	// Step past it in
+			if (range && range->handler==next) {									// whatever list it
+				range = (pgnRange*)range->getNext();								// came from.
+			}																					//
+			if (trace==next) p++;															//
+			if (next->lastDispatch!=dispatchNum) {									// Not seen this one yet?
+				next->lastDispatch = dispatchNum;									// Now they have.
+				if (next->handleMsg(inMsg)) claimed = true;						// Have at it.
+			}																					//
+		}																						//
+	} while(next);																			// 'Till no one's left.
+	return claimed;
+}
+
+
+// Set how much of the incoming queue one idle() will work through. Taking one message
+// per idle() can't keep up with a busy bus if your loop() does anything else. Taking
+// everything, a burst can hold up your loop() for too long. So, up to maxMsgs messages,
+// or maxUs microseconds, whichever comes first. Zero for no limit on either.
+void netObj::setRxDrain(int maxMsgs,unsigned long maxUs) {
+
+	if (maxMsgs<0) maxMsgs = 0;
+	rxMaxMsgs	= maxMsgs;
+	rxMaxUs		= maxUs;
+}
+
+
+// Frames still in the receive ring plus messages waiting for the handlers.
+int netObj::getRxDepth(void) { return ourRxRing.getDepth() + ourMsgQ.getDepth(); }
+
+
+// Work through the waiting messages 'till they run out, or we hit the limits. At least
+// one always gets done, so we can't stall out. Control messages are never left for
+// later, limits or not. They have deadlines.
+void netObj::checkMessages(void) {
+
+	unsigned long	startUs;
+	int				count;
+	bool				overBudget;
+	
+	startUs		= micros();												// Start the clock.
+	count			= 0;														// None yet.
+	overBudget	= false;													// Not yet.
+	while(!overBudget || ourMsgQ.getCtrlDepth()) {				// 'Till we're out of time. (Except for control.)
+		if (!handleNextMsg()) return;									// Nothing left? Done.
+		count++;																// Count it.
+		if (rxMaxMsgs && count>=rxMaxMsgs) overBudget = true;	// That's plenty for one go.
+		if (rxMaxUs && micros()-startUs>=rxMaxUs) overBudget = true;	// Out of time for now.
+	}
+}
+
+
+void netObj::setRxQDepth(int maxMsgs) {
+
+	if (maxMsgs<0) maxMsgs = 0;
+	ourMsgQ.maxDepth = maxMsgs;
+}
+
+
+uint32_t netObj::getRxShed(void) { return ourMsgQ.shed; }
+
+
+// For periodic PGNs where only the latest value counts. If we fall behind, a new one
+// from a source replaces its older one still waiting. The handlers never see the stale
+// ones. Off by default for everything.
+void netObj::setCoalesce(uint32_t PGN,bool onOff) { ourMsgQ.setCoalesce(PGN,onOff); }
+
+
+uint32_t netObj::getRxCoalesced(void) { return ourMsgQ.coalesced; }
+
+
+// Hand us a signalStore and our handlers can post what they read to it. We only write to
+// it from here, the network loop. Read it from wherever you like. (See signalStore.h)
+void netObj::setSignalStore(signalStore* inStore) { ourSignals = inStore; }
+
+
+signalStore* netObj::getSignalStore(void) { return ourSignals; }
+
+
 // This is where we actually handle the vetted incoming messages. The multi packet
 // messages are already assembled as messages with >8 byte data blocks. First we see if
-// it's a network task. These we have to handle ourselves. Then, if not, we ask each the
-// handlers if one of them can handle it. Once a msgHandler handles it, or
-// none will. We are done.	-(Can have > 8 data bytes, see above)-
-void netObj::checkMessages(void) {
+// it's a network task. These we have to handle ourselves. Then, if not, every handler
+// that wants it gets a look. If it was a request to us and no one claimed it, we NACK
+// it. Then we are done.	-(Can have > 8 data bytes, see above)-
+bool netObj::handleNextMsg(void) {
 
 	msgObj*			aMsg;
-	msgHandler*		trace;
-	bool				done;
-	bool				haveRequest;
 	
-	haveRequest = false;														// Well, we don't have one yet.
+	bool				handled;
+	
 	aMsg = (msgObj*)ourMsgQ.pop();										// Pop off the next message object.
 	if (aMsg) {																	// If we got one..
-		if (isRequestMsg(aMsg)) {											// We got a request message, broadcast or peer to peer.
-			if (isAddrClaimReq(aMsg)) {									// Is it a request address claim? "I want your address and name".
-				handelAddrClaimReq(aMsg);									// Do the request address claim dance.
-			} else {																//
-				haveRequest = true;											// We have a request that we've not delat with. We'll see if the added handlers will deal with it.
-			}																		//
-		}																			//
-		else if (isAddrClaim(aMsg)) {										// Else if it's an address claim? "I'm going to use this address. You ok with that?"
-			handleAddrClaim(aMsg);											// Check to see if they are trying to take our address. Deal with this!
-		}																			// 
-		else if (isCantClaim(aMsg)) {										// Else if it's it's a can not claim an address?
-			handleCantClaim(aMsg);											// We.. Well, I donno'. I guess it may have been ours, and this is a confirmation we won?
-		}																			//
-		else if (isCommandedAddr(aMsg)) {								// Someone, or something is trying to change our address.
-			handleComAddr(aMsg);												// If this is all legal, in order, and makes sense. We'll do it.
-		}
-		else {																	// Else this is not something we handle..
-			if (ourState==running) {										// If we are in a running state.
-				done = false;													// Note we're not done.
-				trace = (msgHandler*)getFirst();							// We go through our user's message handlers. Let them have a whack at it.
-				while(!done) {													// For ever handler..
-					if (trace) {												// If non-NULL..
-						if (trace->handleMsg(aMsg)) {						// Can you handled this?
-							haveRequest = false;								// If this was a request, they handled it.
-							done = true;										// If so? We are done.
-						} else {													// Else can't handle it?
-							trace = (msgHandler*)trace->getNext();		//	We grab the next handler on the list.
-						}															// And start all over.
-					} else {														// Else we hit a NULL?
-						done = true;											// In this case we are also done.
-						if (haveRequest) {									// Well, in case we have a request that is still waiting.
-							returnAck(nack,aMsg);							// No one dealt with this se we'll send a NACK.
-						}															//
-					}																//
-				}																	//
-			}																		//
-		}																			//
+		handled = false;														// Not yet.
+		switch(aMsg->rxClass) {												// It was sorted on the way in.
+			case requestFrame	:												// A request..
+				if (isAddrClaimReq(aMsg)) {									// For address claimed? "I want your address and name".
+					handelAddrClaimReq(aMsg);									// Do the request address claim dance.
+					handled = true;												//
+				}																		//
+			break;																	//
+			case claimFrame	:												// An address claim? "I'm going to use this address. You ok with that?"
+				if (isAddrClaim(aMsg)) {										// (Can't claims come in here too. Same PGN.)
+					handleAddrClaim(aMsg);										// Check to see if they are trying to take our address. Deal with this!
+					handled = true;												//
+				}																		//
+			break;																	//
+			case commandFrame	:												// Someone, or something is trying to change our address.
+				if (isCommandedAddr(aMsg)) {									// If it's the right size..
+					handleComAddr(aMsg);											// If this is all legal, in order, and makes sense. We'll do it.
+					handled = true;												//
+				}																		//
+			break;																	//
+			default	: break;														// Everything else is for the handlers.
+		}																				//
+		if (!handled && ourState==running) {							// Not ours to deal with, and we're running?
+			if (!dispatchMsg(aMsg,aMsg->isRequest)) {					// Let our user's message handlers have a whack at it.
+				if (aMsg->isRequest) {											// A request no one claimed?
+					returnAck(nack,aMsg);										// No one dealt with this se we'll send a NACK.
+				}																		//
+			}																			//
+		}																				//
 		delete(aMsg);															// And in the end of it all, we recycle the message object.
+		return true;															// We did one.
 	}
+	return false;																// Nothing waiting.
 }
 			
 					
@@ -1991,7 +5184,7 @@ void netObj::changeState(netObjState newState) {
 				break;														//
 				case addrErr	:											// Address error, uugh! Address conflict I guess.
 					ourXferList.dumpList();								// Clear out xferList, done with it.
-					addr = NULL_ADDR;										// We give up our address.
+					setAddr(NULL_ADDR);									// We give up our address.
 					ourState = addrErr;									// And were in error mode.
 				break;														//
 				default			: 								break;	// No other path to take here.
@@ -2039,7 +5232,12 @@ addrCat netObj::getAddrCat(void) { return ourAddrCat; }
 
 
 // Fine, our address is now inAddr.
-void netObj::setAddr(byte inAddr) { addr = inAddr; }
+// The filters let in messages to our address. New address, new filters.
+void netObj::setAddr(byte inAddr) {
+
+	addr = inAddr;
+	rebuildFilters();
+}
 
 
 // Here's our address.
@@ -2105,9 +5303,9 @@ bool netObj::isCantClaim(message* inMsg) {
 
 
 // Someone is telling somebody to change their address to a given new value. (The 9th byte)
-bool netObj::isCommandedAddr(message* inMsg) {
+bool netObj::isCommandedAddr(msgObj* inMsg) {
 	
-	if (inMsg->getPGN()==COMMAND_ADDR && inMsg->getNumBytes()==9) return true;
+	if (inMsg->rxClass==commandFrame && inMsg->getNumBytes()==9) return true;
 	return false;
 }
 
@@ -2158,18 +5356,20 @@ void netObj::returnAck(ackType inType,message* reqMsg) {
 }
 
 
+// PDU2 are for everyone. PDU1 have to be sent to us, or to everyone.
+bool netObj::isForUs(message* inMsg) {
+
+	if (!inMsg->isPDU1()) return true;
+	return inMsg->getPDUs()==addr || inMsg->getPDUs()==GLOBAL_ADDR;
+}
+
+
 // Is this a request message, either a broadcast or aimed at us?
 bool netObj::isRequestMsg(message* inMsg) {
 
-	uint8_t	reqAddr;
-	
 	if (inMsg) {																			// We got something.
 		if (inMsg->getPDUf()==REQUEST_PF && inMsg->getNumBytes()==3) {		// Correct type and size..
-			reqAddr = inMsg->getPDUs();												// Grab the address.
-			if (reqAddr==addr || reqAddr==GLOBAL_ADDR) {							// If it's to us, or a broadcast.
-				
-				return true;
-			}
+			return isForUs(inMsg);														// If it's to us, or a broadcast.
 		}
 	}
 	return false;
@@ -2178,9 +5378,9 @@ bool netObj::isRequestMsg(message* inMsg) {
 
 // Request address claimed. Someone is asking for everyone, or us, to show who they are
 // and what address they are holding at this moment.
-bool netObj::isAddrClaimReq(message* inMsg) {
+bool netObj::isAddrClaimReq(msgObj* inMsg) {
 		
-	if (isRequestMsg(inMsg)) {								// Its a request broadcast or peer to peer at us.
+	if (inMsg->isRequest) {									// Its a request broadcast or peer to peer at us.
 		return getRequestPGN(inMsg)==ADDR_CLAIMED;	// If they are asking for the address claimed PGN.																				//
 	}																//
 	return false;												// All other cases, false!
@@ -2224,7 +5424,7 @@ void netObj::handleAddrClaim(message* inMsg) {
 				if (waitingForClaim) {										// If we are waiting for a contesting claim..
 					if (inMsg->msgIsLessThanName(this)) {				// If they win the arbitration..
 						sendAddressClaimed(false);							// Let them know, that we know, that they won.
-						addr = NULL_ADDR;										// We give up the address. This flags it for us as well.
+						setAddr(NULL_ADDR);									// We give up the address. This flags it for us as well.
 					} else {														// Else, we win the name fight.
 						sendAddressClaimed(true);							// Rub in face!
 					}																//
@@ -2235,7 +5435,7 @@ void netObj::handleAddrClaim(message* inMsg) {
 			if (inMsg->getSourceAddr()==addr) {							// Claiming our address!?
 				if (inMsg->msgIsLessThanName(this)) {					// If they win the arbitration..
 					sendAddressClaimed(false);								// Let them know, that we know, that they won.
-					addr = NULL_ADDR;											// We give up the address.
+					setAddr(NULL_ADDR);										// We give up the address.
 					if (ourAddrCat==arbitraryConfig) {					// If we do we do arbitration..
 						changeState(arbit);									// We go back to arbitration.
 					} else {														// Else, we don't do arbitration..
@@ -2331,7 +5531,7 @@ void netObj::checkArbit(void) {
 	if (ourArbitState==waitingForAddrs) {			// If gathering addresses, to choose a new one..
 		if (arbitTimer.ding()) {						// If gathering's over..
 			arbitTimer.reset();							// Shut off the timer.
-			addr = chooseAddr();							// Choose an address using the list to compare.
+			setAddr(chooseAddr());						// Choose an address using the list to compare.
 			if (addr!=NULL_ADDR) {						// If we found an unclaimed one..
 				sendAddressClaimed(true);				// Send address claim on new address.
 				startArbitTimer();						// Start the claim timer.
@@ -2433,6 +5633,7 @@ void netObj::idle(void) {
 
 	msgHandler*			trace;
 	
+	checkRxRing();												// Anything come in from the hardware?
 	switch(ourState) {
 		case config		:										// We're in config state. Time to start up!
 			changeState(startHold);							// First pass through idle in config state. Start holding.
@@ -2468,6 +5669,22 @@ void netObj::idle(void) {
 
 
 
+// ***************************************************************************************		
+//                     -----------  fastHandler class  -----------
+// ***************************************************************************************
+
+
+fastHandler::fastHandler(void) {  }
+
+
+fastHandler::~fastHandler(void) {  }
+
+
+// Fill this in. Remember where you are, keep it short.
+bool fastHandler::fastFrame(uint32_t PGN,byte sourceAddr,uint8_t numBytes,const uint8_t* data) { return false; }
+
+
+
 // ***************************************************************************************		
 //                     -----------  msgHandler class  -----------
 // ***************************************************************************************
@@ -2478,6 +5695,9 @@ msgHandler::msgHandler(netObj* inNetObj)
 	
 	ourNetObj	= inNetObj;		// Pointer back to our "boss".
    intervaTimer.reset();		// Default to off.
+	indexed		= false;			// Sees everything 'till it's added by PGN.
+	regSeq		= 0;				// The netObj numbers us when we're added.
+	lastDispatch	= 0;			// Haven't seen anything yet.
 }
 
 
@@ -2492,6 +5712,20 @@ bool msgHandler::handleMsg(message* inMsg) { return false; }
 void msgHandler::newMsg(void) { }
 
 
+// Call this from handleMsg() with a value you just read out of inMsg. It's filed under
+// the message's PGN and who sent it, along with the instance and field you give it.
+// false if there's no store, or it's full.
+bool msgHandler::storeSignal(message* inMsg,byte instance,byte field,float value) {
+
+	signalStore*	store;
+
+	if (!inMsg || !ourNetObj) return false;
+	store = ourNetObj->getSignalStore();
+	if (!store) return false;
+	return store->update(basePGN(inMsg->getPGN()),inMsg->getSourceAddr(),instance,field,value);
+}
+
+
 // The created messages are sent by this guy.
 void msgHandler::sendMsg(message* inMsg) { ourNetObj->outgoingingMsg(inMsg); }
 
@@ -2520,4 +5754,214 @@ void  msgHandler::idleTime(void) {
       intervaTimer.stepTime();
    }
 }
-			
\ No newline at end of file
+			
+
+
+
+// ***************************************************************************************		
+//                     -----------  xferBuilder class  -----------
+// ***************************************************************************************
+
+
+xferBuilder::xferBuilder(netObj* inNetObj) {
+
+	ourNetObj	= inNetObj;		// Who'll send it.
+	ourBuff		= NULL;			// Nothing reserved yet.
+	PGN			= 0;				//
+	priority		= DEF_PRIORITY;	//
+	index			= 0;				//
+	runPtr		= NULL;			//
+	runBytes		= 0;				//
+	overflow		= false;			//
+}
+
+
+// Never committed? Then it goes.
+xferBuilder::~xferBuilder(void) { cancel(); }
+
+
+// Reserve a buffer for inNumBytes of message. Anything we were building is tossed. The
+// bytes all start out 0xFF, so what you don't write reads as unused.
+bool xferBuilder::begin(uint32_t inPGN,uint32_t inNumBytes,byte inPriority) {
+
+	cancel();														// Lose what we had.
+	ourBuff = new xferBuff();									// Get a buffer.
+	if (!ourBuff) return false;								// No RAM? Nothing to build in.
+	if (!ourBuff->setNumBytes(inNumBytes)) {				// Not enough RAM for the data?
+		cancel();													// Give it back.
+		return false;												// And fail.
+	}																	//
+	PGN		= inPGN;												// Save these for commit().
+	priority	= inPriority;										//
+	fill(0xFF,inNumBytes);										// All unused 'till written.
+	seek(0);															// Back to the top.
+	return true;													// Ready.
+}
+
+
+uint32_t xferBuilder::getNumBytes(void) {
+
+	if (ourBuff) return ourBuff->getNumBytes();
+	return 0;
+}
+
+
+uint32_t xferBuilder::getIndex(void) { return index; }
+
+
+// Move to this index. The next put() goes here.
+void xferBuilder::seek(uint32_t inIndex) {
+
+	index		= inIndex;		// Here we are.
+	runPtr	= NULL;			// Find the chunk when we need it.
+	runBytes	= 0;				//
+}
+
+
+bool xferBuilder::getOverflow(void) { return overflow; }
+
+
+// Make sure we're pointing into a chunk. When we run out of the one we're in, find the
+// next. Only then do we do the index math. false means we're off the end.
+bool xferBuilder::nextRun(void) {
+
+	if (!ourBuff) return false;										// Never began? Nowhere to go.
+	if (!runBytes) {													// Used up this chunk?
+		runPtr = ourBuff->getRun(index,&runBytes);				// Find where we are now.
+		if (!runPtr) {													// Off the end?
+			overflow = true;											// Flag it.
+			return false;												// No room.
+		}																	//
+	}																		//
+	return true;														// Good to write.
+}
+
+
+// We just wrote numBytes into the current chunk. Slide everything along.
+void xferBuilder::advance(uint32_t numBytes) {
+
+	runPtr	= runPtr + numBytes;
+	runBytes	= runBytes - numBytes;
+	index		= index + numBytes;
+}
+
+
+// A block of bytes. Copied in a chunk at a time. What won't fit is dropped.
+void xferBuilder::putBytes(const byte* inData,uint32_t numBytes) {
+
+	uint32_t	numCopy;
+	
+	while(numBytes && nextRun()) {							// While there's more and room for it..
+		numCopy = numBytes;										// Everything that's left..
+		if (numCopy>runBytes) numCopy = runBytes;			// That fits this chunk.
+		memcpy(runPtr,inData,numCopy);						// In it goes.
+		advance(numCopy);											// Move past it.
+		inData	= inData + numCopy;							//
+		numBytes	= numBytes - numCopy;						//
+	}
+}
+
+
+// Same as putBytes() but it's all the same value.
+void xferBuilder::fill(byte value,uint32_t numBytes) {
+
+	uint32_t	numSet;
+	
+	while(numBytes && nextRun()) {
+		numSet = numBytes;
+		if (numSet>runBytes) numSet = runBytes;
+		memset(runPtr,value,numSet);
+		advance(numSet);
+		numBytes = numBytes - numSet;
+	}
+}
+
+
+// Low byte first. Same as the message set..InData() calls.
+void xferBuilder::putValue(uint64_t value,int numBytes) {
+
+	byte	bytes[8];
+	
+	for (int i=0;i<numBytes;i++) {
+		bytes[i] = value & 0xFF;
+		value = value >> 8;
+	}
+	putBytes(bytes,numBytes);
+}
+
+
+void xferBuilder::putByte(byte inByte) { putBytes(&inByte,1); }
+
+void xferBuilder::putInt(int16_t value) { putValue((uint16_t)value,2); }
+
+void xferBuilder::putUInt(uint16_t value) { putValue(value,2); }
+
+void xferBuilder::putLong(int32_t value) { putValue((uint32_t)value,4); }
+
+void xferBuilder::putULong(uint32_t value) { putValue(value,4); }
+
+void xferBuilder::putDLong(int64_t value) { putValue((uint64_t)value,8); }
+
+void xferBuilder::putDULong(uint64_t value) { putValue(value,8); }
+
+void xferBuilder::putPGN(uint32_t PGN) { putValue(PGN,3); }
+
+
+// Just the characters. If you want a terminator or a '*' delimiter, put one.
+void xferBuilder::putString(const char* inStr) {
+
+	if (inStr) putBytes((const byte*)inStr,strlen(inStr));
+}
+
+
+// A fixed size string field. Too long gets chopped, too short gets padded.
+void xferBuilder::putString(const char* inStr,uint32_t fieldBytes,byte pad) {
+
+	uint32_t	numChars;
+	
+	numChars = 0;
+	if (inStr) numChars = strlen(inStr);
+	if (numChars>fieldBytes) numChars = fieldBytes;
+	putBytes((const byte*)inStr,numChars);
+	fill(pad,fieldBytes-numChars);
+}
+
+
+// Send it off. The transfer takes the buffer, no copying. The message is just a header
+// to tell the transfer list what it is. If it wouldn't go, (Broadcast too big?) the buffer
+// is gone anyway and you get false.
+bool xferBuilder::commit(xferHandle* inHandle) {
+
+	message	header(0);
+	bool		sent;
+	
+	if (!ourBuff || !ourNetObj) return false;				// Nothing to send, or no one to send it.
+	header.setPGN(PGN);											// What it is.
+	header.setPriority(priority);								// How important.
+	header.setSourceAddr(ourNetObj->getAddr());			// Who it's from.
+	header.attachBuff(ourBuff);								// The data.
+	ourBuff = NULL;												// Not ours anymore.
+	seek(0);															//
+	if (inHandle) {												// If they want to hear how it went..
+		sent = ourNetObj->sendXfer(&header,inHandle);	// Send it with the handle.
+	} else {															// Else..
+		ourNetObj->outgoingingMsg(&header);					// Just send it.
+		sent = true;												//
+	}																	//
+	if (header.getNumBytes()>8 && header.getBuff()) {	// A transfer would have taken it..
+		sent = false;												// So it didn't go.
+	}																	//
+	return sent;													// Buffer goes with the header if no one took it.
+}
+
+
+// Toss whatever we're building.
+void xferBuilder::cancel(void) {
+
+	if (ourBuff) {
+		ourBuff->release();
+		ourBuff = NULL;
+	}
+	seek(0);
+	overflow = false;
+}
@@ -57,6 +57,8 @@
 #define BAM_COMMAND		60416		// Big load coming! Make room!
 #define ADDR_CLAIMED		60928		// Claimed PGN. "Hey EVERYONE this is my name and address." Or can't claim one.
 #define COMMAND_ADDR		65240		// We were told to use this address.
+#define ETP_DATA_XFER	50944		// Extended transport, multi packet chunk of data. (Big stuff)
+#define ETP_FLOW_CON		51200		// Extended transport, connection management.
 
 #define ACKNOWLEDGE_PF		232	// PDUs = Dest Addr, Data[0] : ack=0, nack=1, denied=2, notNow=3.
 #define REQUEST_PF			234	// 0xEA, PS = Destination addr. 
@@ -65,6 +67,8 @@
 #define SEND_REQ				236	// 0xEC, PS = Destination addr. Doubles as peer to peer BAM message.
 #define ADDR_CLAIMED_PF		238	// 0xEE, PS = 255. Works for both (ACK) & (NACK)
 #define COMMAND_ADDR_PF		254	// PS = 216. Giving PGN of COMMAND_ADDR above.
+#define ETP_DATA_XFER_PF	199	// 0xC7, PS = Destination addr. Extended transport is peer to peer only.
+#define ETP_FLOW_CON_PF		200	// 0xC8, PS = Destination addr.
 
 
 #define DEF_NUM_BYTES	8			// Remember data is 0..8 bytes? Most are 8 bytes. We default to that.
@@ -73,6 +77,11 @@
 #define DEF_R				false		// R (reserved bit) All the doc.s say to leave it as 0.
 #define DEF_DP				false		// DP (Data page) All doc.s say to leave it  as 0. But nearly ALL NMEA 2000 sets it as high order PGN bit (1).
 
+#define TP_MAX_BYTES		1785		// 255 packets of 7 bytes. The most the regular transport protocol can move.
+#define ETP_MAX_BYTES	117440505	// 16777215 packets of 7 bytes. The most extended transport can move.
+#define ETP_WIN_PACKS	16			// Extended transport, how many packets we let them send per clear to send.
+#define XFER_CHUNK_BYTES	TP_MAX_BYTES	// Transfer buffers are allocated in chunks of this size. So a TP message is always one chunk.
+
 
 // These guys are times for holding, timeout etc. Used in the peer to peer, broadcasts, muti-packet code. Right out of the book.
 #define TR_MS				200		// Response time.
@@ -84,11 +93,42 @@
 #define TWMIN_MS			50			// After broadcasting you must wait a random amount before the next broadcast. This is MIN.
 #define TWMAX_MS			200		// This is MAX.
 #define BCAST_T1_MS		750		// Incoming broadcast timeout.
+#define BAM_GAP_MS		TWMIN_MS	// Outgoing broadcasts all share one clock. One packet every this many ms.
+#define P2P_GAP_MS		0			// Peer to peer (ETP) data packets. The receiver paces with its windows, so zero.
+#define RETRY_TRIES		3			// Outgoing peer to peer, how many times we retry after busy or timeout.
+#define RETRY_MS			250		// First retry waits this long. Each one after that waits twice as long..
+#define RETRY_MAX_MS		4000		// Up to this.
+
+#define BUS_BPS			250000	// J1939 & NMEA 2000 bus speed, bits per second.
+#define BW_TP_PCT			30			// Share of the bus regular transport data packets can use.
+#define BW_BULK_PCT		20			// Same for extended transport. (Bulk)
+#define BW_BURST_MS		20			// How much unused share a class can save up. In ms worth.
+
+#define RX_BUDGET_BYTES	0			// Default RAM we allow for reassembling incoming transfers. All of 'em together. Zero for no limit.
+#define XFER_STALL_MS	500		// An incoming transfer that's heard nothing in this long is stalled. Fair game for eviction.
+#define XFER_HOLD_MS		500		// When we can't take a transfer yet, we send a "hold" clear to send this often..
+#define XFER_MAX_HOLDS	20			// This many times. Then we give up on it.
+#define SRC_MAX_SESSIONS	2			// Incoming transfers one source can have running at once. (A BAM and a peer to peer)
+#define SRC_MAX_ANNOUNCE	10			// BAMs and request to sends one source can start..
+#define SRC_ANNOUNCE_MS	1000		// In this many ms. More than that is a flood and ignored.
+#define RX_RING_SIZE		32			// Frames the receive ring can hold 'till idle() gets to them. Power of two, 128 max.
+#define RX_DRAIN_MSGS		16			// Most incoming messages one idle() will hand to the handlers. Zero for no limit.
+#define RX_DRAIN_US		2000		// Or stop after this many microseconds. Zero for no limit. (Saturated bus is ~1,800 frames/s)
+#define RX_FILTER_MAX		6			// Acceptance filters the CAN hardware has. (MCP2515 has six) Zero for no limit.
+#define RX_Q_MAX_DEPTH	32			// Incoming message queue, most it holds. Past that, data messages are shed. Zero for no limit.
+#define RX_Q_HIGH_WATER	8			// Incoming message queue this deep? Peer to peer senders are held 'till it drains.
+#define RX_POOL_HIGH_WATER	(3*TP_MAX_BYTES)	// Same for others' reassembly RAM. (Resume at half of either.)
+#define FAST_LANE_MAX	4			// Fast lane handlers one netObj can have. (PGN, handler pairs)
 
 class netName;							// Forward class thing. Don't worry about it.
 class msgHandler;						// And another one. Just look the other way. Maybe hum a little.
 class netObj;							// These things seem to breed..
 class xferList;						// I swear it's like rats!
+class xferBuff;						// Told you.
+class xferSink;						// And another..
+class outgoingBroadcast;			// Stop it!
+class xferNode;						// Ok, I give up.
+class signalStore;					// See? Gave up. (signalStore.h)
 
 
 
@@ -100,6 +140,18 @@ bool	isBlank(uint16_t inVal);
 bool	isBlank(uint32_t inVal);
 
 
+// PDU1 PGNs (PDUf < 240) carry the destination address in their low byte. When you want
+// to know what kind of message it is, and not who it's to, this clears that byte out.
+
+uint32_t	basePGN(uint32_t PGN);
+
+
+// Is a message with this PGN a broadcast? PDU2 PGNs always are. PDU1 are if they're sent
+// to the global address. Same answer as message::isBroadcast(), without building one.
+
+bool	isBroadcastPGN(uint32_t PGN);
+
+
 
 // The byte order is not the same as Arduino. It could be different than whatever YOU are
 // trying to use the for. So we have these six integer byte ordering routines to make life
@@ -117,10 +169,86 @@ uint64_t packU64(byte hiByte,byte byte6,byte byte5,byte byte4,byte byte3,byte by
 
 extern bool showReq;
 
+
+// ***************************************************************************************
+//				         -----    xferBuff   &  buffChunk    -----
+// ***************************************************************************************
+
+
+// Data blocks for multi packet transfers. Regular transport tops out at 1785 bytes and that
+// fits in one chunk. Extended transport can run into the hundreds of kilobytes. Asking for
+// that as one contiguous block is asking for trouble. So xferBuff hands out the RAM as a
+// list of XFER_CHUNK_BYTES sized chunks, and does the index math for you. It remembers the
+// last chunk it used, so walking through the data in order costs next to nothing.
+//
+// Once share()ed, a buffer is frozen. No more writes, no handing the data off. Then any
+// number of messages and outgoing transfers can point at the same one, each holding a
+// reference. The last one to release() it, recycles it. So one 500 byte answer can go out
+// to five requesters, and a BAM, off one copy of the data.
+
+class buffChunk :	public linkListObj {
+
+	public:
+				buffChunk(byte* inData,uint32_t inNumBytes);
+	virtual	~buffChunk(void);
+
+				byte*		data;			// This chunk's piece of the data. We own it.
+				uint32_t	numBytes;	// How big this piece is.
+};
+
+
+class xferBuff :	public linkList {
+
+	public:
+				xferBuff(void);
+	virtual	~xferBuff(void);
+
+				bool		setNumBytes(uint32_t inNumBytes);				// Allocate room for this many bytes, in chunks. Zero recycles it all.
+				uint32_t	getNumBytes(void);									// How many bytes we hold.
+				void		adoptData(byte* inData,uint32_t inNumBytes);	// Take ownership of an allocated block as our one and only chunk.
+				byte*		passData(void);										// If we are one chunk, hand it over and empty ourselves. Otherwise NULL.
+				byte		getByte(uint32_t index);							// Read a byte.
+				void		setByte(uint32_t index,byte inByte);			// Write a byte. (Ignored once we're shared.)
+				byte*		getRun(uint32_t index,uint32_t* runBytes);	// Pointer to this byte & how many follow it in the same chunk.
+				void		share(void);											// Freeze our data so it can be shared.
+				bool		isShared(void);										// Are we frozen & shared?
+				void		retain(void);											// Someone else is using us too.
+				void		release(void);											// Someone is done with us. Last one out deletes us.
+
+	protected:
+				buffChunk*	findChunk(uint32_t index);						// Which chunk holds this index? Sets lastChunk & lastStart.
+
+				uint32_t		numBytes;		// Total over all the chunks.
+				buffChunk*	lastChunk;		// Last chunk we landed in.
+				uint32_t		lastStart;		// And the index of it's first byte.
+				int			refCount;		// How many are holding onto us.
+				bool			shared;			// Frozen, read only.
+};
+
+
+
 // ***************************************************************************************
 //				----- message -----
 // ***************************************************************************************
 
+
+// What kind of frame is it? Everything on the way in used to ask this over and over. Is it
+// transport? A request? A claim? Each one pulling the PDUf apart again, some building the
+// whole PGN to do it. Now getClass() works it out once, from the ID, with a table look up
+// on the PDUf. Each frame is then sent straight to whoever deals with its kind, and the
+// answer rides along with it in the queue.
+
+enum frameClass {
+	appFrame,		// Application data. Your handlers get these.
+	ackFrame,		// Acknowledgement. Your handlers get these too, but they jump the queue.
+	requestFrame,	// "Send me this PGN."
+	claimFrame,		// Address claimed, or can't claim.
+	commandFrame,	// Commanded address. (It's 9 bytes, so it shows up as a finished BAM.)
+	tpConFrame,		// Transport connection management. RTS, CTS, BAM, EOM, abort. Regular & extended.
+	tpDataFrame		// Transport data packet. Regular & extended.
+};
+
+
 class message {
 
 	public:
@@ -152,7 +280,12 @@ class message {
 				byte*		peekData(void);
 				byte*		passData(void);
 				void		acceptData(byte* inData,int inNumBytes);
-				
+				void		attachBuff(xferBuff* inBuff);							// Take ownership of a (possibly chunked) transfer buffer as our data.
+				xferBuff*	passBuff(void);										// Hand over our transfer buffer, if we have one.
+				xferBuff*	getBuff(void);											// Peek at our transfer buffer. NULL means plain data.
+				xferBuff*	shareData(void);										// Freeze our data into a shared buffer. Send us as often as you like.
+				void		shareBuff(xferBuff* inBuff);						// Point at someone's shared buffer as our data.
+
 				void		setIntInData(int startIndex,int16_t value);		// Put a signed int into the data with correct byte ordering.
 				int16_t	getIntFromData(int startIndex);						// Get a signed int from the data with correct byte ordering.
 				
@@ -177,11 +310,14 @@ class message {
 				uint32_t getData0PGN(void);										// This should make setting and getting them a lot easier.
 				bool		msgIsLessThanName(netName* inName);					// For settling the address fights.
 				bool		isBroadcast(void);										// If the message is complete we can read this.
+				bool		isPDU1(void);												// Peer to peer type? (PDUs is the destination)
+				frameClass	getClass(void);										// What kind of frame is this? Just the ID, not the size.
 				void		showMessage(void);										// Handy in so many ways. 
 				
 	protected:
 				int		numBytes;	// Size of our data buffer.
 				byte*		msgData;		// The data buffer itself!
+				xferBuff*	msgBuff;	// OR, big transfers bring their data in a chunked buffer.
 				uint8_t	priority;	// CAN priority bits.
 				bool		R;				// Reserve bit.
 				bool		DP;			// Data page.
@@ -481,14 +617,23 @@ public:
 // sending or receiving. Think of each xferNode as if it were it's own message transfer
 // thread. There are four types of transfer. Ones we start ourselves, both broadcast and
 // peer to peer. And, one that come to us, both broadcast and peer to peer.
+//
+// Then there's extended transport (ETP). Same idea as peer to peer, but for messages
+// larger than 1785 bytes. Clear to sends carry a 24 bit packet number, and each window
+// of packets is preceded by a data packet offset (DPO) message so the one byte sequence
+// numbers in the data packets can start over at one. Broadcasting is not a thing here.
+//
+// [20] [Size LSB] [Size2] [Size3] [Size MSB] [PGN LSB] [PGN2] [PGN MSB]
 
 
-// Our four types/starting points.
+// Our six types/starting points.
 enum xferTypes {
 	broadcastIn,	// We receive a BAM message.
 	broadcastOut,	// We create a BAM message.
 	peerToPeerIn,	// We receive a "request to send" from a peer.
-	peerToPeerOut	// We send "request to send" to peer.
+	peerToPeerOut,	// We send "request to send" to peer.
+	extendedIn,		// We receive an extended "request to send" from a peer.
+	extendedOut		// We send an extended "request to send" to a peer.
 };
 
 
@@ -506,17 +651,30 @@ enum flowContType {
 	clearToSend	= 17,
 	endOfMsg		= 19,
 	BAM			= 32,		// For broadcast.
+	etpReqToSend	= 20,	// Extended transport versions. For peer to peer only.
+	etpClearToSend	= 21,
+	etpDataOffset	= 22,
+	etpEndOfMsg		= 23,
 	abortMsg		= 255
 };
 
 
+// Incoming, asking for room to reassemble into.
+enum roomResult {
+	roomOK,			// Got it. Go!
+	roomWait,		// Not now, but it could fit later. Hold 'em off.
+	roomNone			// Never going to happen.
+};
+
+
 // Why is this transmission failing?
 enum abortReason {
 	notAbort,		// Not because of a received abort. Mostly unexpected msg.
 	busyAbort,
 	resourceAbort,
 	timoutAbort,
-	noReason
+	noReason,
+	noPeerAbort		// Never sent. They're not in our address list, so we didn't bother.
 };
 
 // Abort values : 4..250 Are reserved by SAE for unknown reasons.
@@ -525,6 +683,142 @@ enum abortReason {
 // should feel thankful for getting 4 whole values. :) 
 				
 				
+// Pacing outgoing data packets. Instead of "wait this long after whenever we got around to
+// sending the last one", each packet gets a deadline. Next deadline is the last deadline
+// plus the gap. So if the loop runs late for one packet, the next one isn't late too.
+// But catching up can't squeeze packets closer than the minimum gap. It also keeps track
+// of the gaps we actually managed, so you can see if your loop is keeping up.
+
+class txPacer {
+
+	public:
+				txPacer(void);
+	virtual	~txPacer(void);
+	
+				void	reset(void);								// Forget the deadline. Next one can go now.
+				void	resetStats(void);							// Clear the measured gaps.
+				bool	isDue(void);								// Time to send?
+				long	msToGo(void);								// How long 'till the next one is due. Zero, now.
+				void	markSent(int gapMs,int minGapMs);	// We sent one. Set up the next deadline.
+	
+				bool				started;		// Sent one yet?
+				unsigned long	dueMs;		// When the next one's due.
+				unsigned long	lastMs;		// When we actually sent the last one.
+				unsigned long	gapLast;		// Measured, last gap.
+				unsigned long	gapMin;		// Measured, smallest gap.
+				unsigned long	gapMax;		// Measured, largest gap.
+				uint32_t			numGaps;		// How many gaps we've measured.
+};
+
+
+// How much of the bus are we using, and for what? Every frame we send is worth some number
+// of bits on the wire. Header, data, CRC and all, plus worst case bit stuffing. Frames
+// are sorted into classes by their PDUf. Network management (Address claims, requests,
+// acks, flow control), transport data, extended transport (bulk) data, and everything
+// else. Which is mostly your periodic stuff.
+//
+// Each class can have a share of the bus, as a percent. Its bucket fills at that rate and
+// sending empties it. Transport and bulk data packets wait when their bucket is empty.
+// Network management and periodic frames never wait. Their bits are just counted. So no
+// matter how much bulk is lined up, it can't use more than its share and your 100 ms
+// engine updates still go out on time. A share of zero means no limit.
+
+enum bwClass {
+	bwNetMgmt,		// Address claims, requests, acks, transport flow control.
+	bwPeriodic,		// Everything else. Your messages.
+	bwTPData,		// Regular transport data packets.
+	bwBulk,			// Extended transport data packets.
+	bwNumClasses
+};
+
+
+class bandwidthMgr {
+
+	public:
+				bandwidthMgr(void);
+	virtual	~bandwidthMgr(void);
+	
+				void		setBusRate(uint32_t bitsPerSec);				// How fast is the bus?
+				uint32_t	getBusRate(void);									//
+				void		setShare(bwClass aClass,uint8_t percent);		// Zero is no limit.
+				uint8_t	getShare(bwClass aClass);						//
+				void		setBurst(int ms);									// How much can a class save up?
+				int		frameBits(int numBytes);						// Worst case bits on the wire for a frame this size.
+				bwClass	classify(byte PDUf);								// What class is a frame with this PDUf?
+				bool		canSend(bwClass aClass);						// Room in this class's bucket?
+				long		msToSend(bwClass aClass);						// How long 'till there is? Zero, now.
+				void		charge(message* inMsg);							// We sent this. Take it out of its bucket.
+				void		resetStats(void);									// Clear the counters.
+				void		refill(void);										// Top up the buckets for the time gone by.
+				long		classRate(bwClass aClass);						// A class's share in bits per second. (1/1000 bits per ms)
+				
+				uint32_t			busRate;						// Bits per second.
+				int				burstMs;						// Bucket depth, in ms worth of share.
+				uint8_t			share[bwNumClasses];		// Percent of the bus for each.
+				long				tokens[bwNumClasses];	// What's in each bucket. In 1/1000 bits.
+				unsigned long	lastMs;						// When we last topped them up.
+				uint32_t			bitsSent[bwNumClasses];	// Counters, bits we've sent.
+				uint32_t			framesSent[bwNumClasses];	// And frames.
+};
+
+
+// When an outgoing peer to peer transfer comes back busy, or times out, we can try again.
+// This is how. Each transfer gets its own copy. From its PGN's policy if it has one, or
+// the list's default if not. needPeer means, if they're not in our address list, don't
+// even start. Fail right now. It's off by default. The list only knows who's claimed an
+// address since we started, or since you last called refreshAddrList(). So turn it on
+// once you've filled the list, or devices that were already on the bus look missing.
+
+class xferRetry {
+
+	public:
+				xferRetry(void);
+	virtual	~xferRetry(void);
+	
+				uint8_t	maxTries;		// How many retries. Zero for none.
+				int		backoffMs;		// First retry waits this long. Doubles each time after.
+				int		maxBackoffMs;	// But never longer than this.
+				bool		needPeer;		// Not in the address list? Fail fast. (Default off)
+};
+
+
+// outgoingingMsg() just fires and forgets. If you want to know how a big send went, use
+// sendXfer() and hand it one of these. It's yours, you create it and it lives as long as
+// you like. Poll it with isDone(), or inherit it and fill in xferDone() to be called when
+// it's over. Either way you get success, the abort reason, bytes sent and elapsed time.
+// Delete it while it's running and the transfer carries on, it just won't tell anyone.
+
+class xferHandle {
+
+	public:
+				enum handleStates {
+					handleIdle,		// Never been used.
+					handleRunning,	// Transfer's underway.
+					handleDone		// It's over. Have a look.
+				};
+				
+				xferHandle(void);
+	virtual	~xferHandle(void);
+	
+	virtual	void			xferDone(void);							// Fill this in to hear about it the moment it's over.
+				bool			isDone(void);								// Poll this. True once it's over.
+				uint32_t		getBytesSent(void);						// So far, or in the end.
+				unsigned long	getElapsedMs(void);					// So far, or in the end.
+				void			begin(uint32_t inNumBytes);			// We're using this. The rest is for the library.
+				void			finish(bool inSuccess,abortReason inReason,uint32_t inBytes);
+				
+				handleStates	state;		// Where we're at.
+				bool				success;		// Did it work?
+				abortReason		reason;		// If not, why not?
+				uint8_t			tries;		// How many retries it took.
+				uint32_t			numBytes;	// How many we wanted to send.
+				uint32_t			bytesSent;	// How many went.
+				unsigned long	startMs;		// When we started.
+				unsigned long	elapsedMs;	// How long it took.
+				xferNode*		ourNode;		// The transfer doing the work. NULL when it's done.
+};
+
+
 // Pure virtual base class to a transfer node. Think of it kinda' like a process thread.
 // We'll spawn one when we need to do a multi transfer. Then delete it when the transfer
 // is complete.
@@ -537,25 +831,68 @@ class xferNode :	public linkListObj {
 	virtual	void			idleTime(void)=0;
 				abortReason	valueToReason(byte value);
 	virtual	bool			isOurMsg(message* inMsg);
+				bool			isPeerMsg(message* inMsg);
 	virtual	bool			handleMsg(message* inMsg);
 				void			startTimer(int lowMs,int hiMs);
-				void			addMsgToQ(message* msg);
+				bool			takeData(message* inMsg);
+				bool			allocData(void);
+				void			storeData(message* inMsg);
+				bool			openSink(void);
+				roomResult	getRoom(void);
+				bool			waitRoom(void);
+				bool			waitResume(void);
+				bool			peerOnline(void);
+				bool			retryLater(void);
+				void			startOrWait(void);
+	virtual	void			startXfer(void);
+				void			attachHandle(xferHandle* inHandle);
+				void			done(bool inSuccess,abortReason inReason);
+				void			finishHandle(void);
+				void			sendHold(void);
+				uint32_t		rxBytes(void);
+				bool			stalled(void);
+	virtual	void			evict(void);
+	virtual	outgoingBroadcast*	queuedBAM(void);
+	virtual	bool			bamFrom(byte srcAddr);
+	virtual	long			msToTx(void);
+	virtual	void			serviceTx(void);
+				bool			bwClear(void);
+				long			bwWait(void);
+				void			addMsgToQ(void);
 				void			saveFCID(message* initMsg);
 				bool			checkFCID(message* inMsg);
 				void			sendflowControlMsg(flowContType msgType,abortReason reason=notAbort);
-				bool			sendDataMsg(void);
+				bool			sendDataMsg(uint32_t seqBase=0);
 				
 				bool			complete;		// complete as true means we are done and ready to be recycled.
 				bool			success;			// success means that were able to assemble all the data without an error.
 				abortReason	reason;			// If we got an abort, this is the reason for it.
 				netObj*		ourNetObj;		// Pointer back to the big boss. For addresses and sending stuff.
+				xferList*	ourList;			// The list we live on.
 				timeObj		xFerTimer;		// For holding before sending and timeouts for receiving.
 				uint8_t		msgAddr;			// Their address. Ours is passed in.
-				byte*			msgData;			// Used for holding the data. In or out.
-				uint16_t		msgSize;			// The total number of bytes for this message data block.
-				uint8_t		msgPacks;		// How many packets we will be sending or expecting.
-				uint8_t		packNum;			// Numbering from 1, what packet are we sending or expecting.
-				uint16_t		byteTotal;		// How many bytes we've sent/received of this message data block
+				uint8_t		fcPDUf;			// PDUf of our flow control messages. TP or ETP.
+				uint8_t		dtPDUf;			// PDUf of our data packets. TP or ETP.
+				xferBuff*	msgBuff;			// Used for holding the data. In or out. Possibly in chunks.
+				uint32_t		msgSize;			// The total number of bytes for this message data block.
+				uint32_t		msgPacks;		// How many packets we will be sending or expecting.
+				uint32_t		packNum;			// Numbering from 1, what packet are we sending or expecting.
+				uint32_t		byteTotal;		// How many bytes we've sent/received of this message data block
+				uint32_t		winStart;		// ETP, packets sent before the current window. (The DPO offset)
+				uint8_t		winPacks;		// ETP, how many packets in the current window.
+				xferSink*	ourSink;			// Incoming, if someone wants this streamed to them, it's here.
+				byte*			sinkBuff;		// And if they handed us their own buffer to fill, it's here.
+				bool			incoming;		// Are we reassembling? Counts against the budget.
+				uint8_t		rxPrio;			// Incoming, how important are we? 0 highest, 7 lowest. Like CAN.
+				bool			holding;			// Sending a "hold" clear to send. (Zero packets)
+				uint8_t		holdCount;		// How many holds we've sent while waiting for room.
+				unsigned long	lastMs;		// Incoming, when we last heard something.
+				xferRetry	retry;			// Outgoing, what to do if it doesn't go through.
+				uint8_t		tries;			// How many times we've retried.
+				xferHandle*	ourHandle;		// Outgoing, if someone's waiting to hear how it went.
+				bool			toPeer;			// Outgoing peer to peer. Only one of these at a time per destination.
+				bool			waitTurn;		// Someone else is talking to our peer. Waiting for them to finish.
+				uint32_t		peerSeq;			// Order we lined up in for our peer.
 				uint32_t		xferPGN;			// PGN of the message being transferred.
 				uint8_t		byte5;			// The three bytes of PGN for flow control messages. Ready to go.
 				uint8_t		byte6;			//
@@ -567,10 +904,23 @@ class xferNode :	public linkListObj {
 class outgoingBroadcast :	public xferNode {
 
 	public:
+				enum bamStates {
+					bamQueued,		// Waiting our turn. Only one broadcast at a time.
+					bamSending		// Our turn. Announced and sending data.
+				};
+				
 				outgoingBroadcast(message* inMsg,netObj* inNetObj,xferList* inList);
 	virtual	~outgoingBroadcast(void);
 	
 	virtual	void	idleTime(void);
+	virtual	void	serviceTx(void);
+	virtual	outgoingBroadcast*	queuedBAM(void);
+				void	startBAM(void);
+				bool	goesBefore(outgoingBroadcast* other);
+	
+				bamStates	ourState;
+				uint8_t		bamPrio;		// Priority of the message we're sending. Lowest goes first.
+				uint32_t		bamSeq;		// Order we were queued in. Same priority? First come first served.
 };
 
 
@@ -580,7 +930,9 @@ class outgoingPeerToPeer :	public xferNode {
 				// Why are we waiting again?
 				enum waitStates {
 					waitToSend,
-					waitForACK
+					sendingData,	// Got our clear to send. Packet goes when there's bandwidth.
+					waitForACK,
+					waitToRetry		// Busy or timed out. Backing off before we try again.
 				};
 				
 				outgoingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList);
@@ -588,6 +940,9 @@ class outgoingPeerToPeer :	public xferNode {
 	
 	virtual	bool	handleMsg(message* inMsg);
 	virtual	void	idleTime(void);
+	virtual	void	startXfer(void);
+	virtual	long	msToTx(void);
+	virtual	void	serviceTx(void);
 	
 				waitStates	ourState;
 };
@@ -601,6 +956,7 @@ class incomingBroadcast :	public xferNode {
 	
 	virtual	bool	handleMsg(message* inMsg);
 	virtual	void	idleTime(void);
+	virtual	bool	bamFrom(byte srcAddr);
 	
 };
 
@@ -608,12 +964,164 @@ class incomingBroadcast :	public xferNode {
 class incomingPeerToPeer :	public xferNode {
 
 	public:
-	
+				enum tpStates {
+					waitForRoom,	// Holding them off 'till there's RAM for this.
+					waitToResume,	// Holding them off 'till we catch up.
+					waitForData		// Clear to send went out, data should be coming.
+				};
+				
 				incomingPeerToPeer(message* inMsg,netObj* inNetObj,xferList* inList);
 	virtual	~incomingPeerToPeer(void);
 	
 	virtual	bool	handleMsg(message* inMsg);
 	virtual	void	idleTime(void);
+	virtual	void	evict(void);
+	
+				tpStates	ourState;
+};
+
+
+class outgoingExtended :	public xferNode {
+
+	public:
+				enum etpStates {
+					waitToSend,		// Waiting for a clear to send.
+					sendingData,	// Pumping out a window of packets.
+					waitForACK,		// All sent, waiting for end of message ACK.
+					waitToRetry		// Busy or timed out. Backing off before we try again.
+				};
+
+				outgoingExtended(message* inMsg,netObj* inNetObj,xferList* inList);
+	virtual	~outgoingExtended(void);
+
+	virtual	bool	handleMsg(message* inMsg);
+	virtual	void	idleTime(void);
+	virtual	void	startXfer(void);
+	virtual	long	msToTx(void);
+	virtual	void	serviceTx(void);
+
+				etpStates	ourState;
+				txPacer		pacer;			// Spaces out our data packets.
+};
+
+
+class incomingExtended :	public xferNode {
+
+	public:
+				enum etpStates {
+					waitForRoom,	// Holding them off 'till there's RAM for this.
+					waitToResume,	// Holding them off 'till we catch up.
+					waitForDPO,		// We sent a clear to send. Waiting for the data packet offset.
+					waitForData		// Got the offset, data packets should be coming.
+				};
+
+				incomingExtended(message* inMsg,netObj* inNetObj,xferList* inList);
+	virtual	~incomingExtended(void);
+
+	virtual	bool	handleMsg(message* inMsg);
+	virtual	void	idleTime(void);
+	virtual	void	evict(void);
+				void	sendWindow(void);
+
+				etpStates	ourState;
+};
+
+
+// Normally an incoming transfer is assembled into one big buffer, then handed to your
+// msgHandlers as a message once the last byte shows up. On a small RAM machine that big
+// buffer can be the difference between working and answering resourceAbort.
+//
+// So, inherit xferSink, give it the PGN you're after and add it with addXferSink(). When a
+// transfer of that PGN starts, beginXfer() gets a look. Return false and it's business as
+// usual. Return true and either hand back your own buffer from getBuffer() to have it
+// filled directly, or hand back NULL and have it streamed to you, in order, through
+// dataChunk() as the packets come in. Either way endXfer() tells you how it ended. No
+// message is queued for these.
+
+class xferSink :	public linkListObj {
+
+	public:
+				xferSink(uint32_t inPGN);
+	virtual	~xferSink(void);
+	
+	virtual	bool	beginXfer(byte srcAddr,uint32_t numBytes);				// A transfer is starting. Want it?
+	virtual	byte*	getBuffer(uint32_t numBytes);									// Your buffer to fill. NULL means stream it to dataChunk().
+	virtual	void	dataChunk(uint32_t offset,byte* data,int numBytes);	// Streaming, each packet's worth of data. In order.
+	virtual	void	endXfer(bool success,abortReason reason);					// And it's over. How'd it go?
+	
+				uint32_t	sinkPGN;		// The PGN we're here for.
+};
+
+
+// Every incoming transfer wants RAM to reassemble into. Power up a bus with forty devices
+// all announcing at once and that's a lot of RAM. So the list keeps a budget. Incoming
+// transfers have to fit in what's left, or push out someone stalled or less important to
+// get in. Broadcasts that can't fit are just ignored. Peer to peer senders are told to
+// hold on 'till there's room. Set the budget with setRxBudget(), zero means no limit. And
+// that's the default. A budget also caps the biggest single transfer, so leave it off if
+// you want the big extended ones without a sink. Something like 4*TP_MAX_BYTES is a good
+// start on a small board.
+//
+// Outgoing broadcasts (BAMs) are different. J1939 only allows one at a time from each
+// address. So they queue up here and go one after the other, most important message
+// priority first, all paced by one clock.
+//
+// Pacing, the time between outgoing data packets, is set per destination class. setBAMGap()
+// for broadcasts, setP2PGap() for peer to peer. A PGN can have its own with setTxGap().
+// Broadcast gaps are held to J1939's 50..200 ms unless you turn on fast mode. That's for
+// closed segments where you know who's listening and they can keep up. Sending runs off
+// deadlines in serviceTx(). idle() calls it, but if you want tight spacing call it from
+// somewhere quicker. nextTxMs() tells you how long 'till something's due.
+//
+// How important a transfer is comes from its PGN. Set that with setPriority(). Zero is
+// the most important, seven the least. Same as CAN. Anything not set gets DEF_PRIORITY.
+//
+// And, if the incoming message queue backs up because the handlers are busy, or everyone
+// else's reassembly RAM goes over its mark, peer to peer senders are held between packets
+// 'till things drain back down to half. They slow down, we don't drop anything. Set the
+// marks with setHighWater(), zero turns either off.
+//
+// J1939 allows one peer to peer session between any two addresses at a time. So our
+// outgoing peer to peer transfers, TP or ETP, line up per destination. The first one to a
+// peer goes, the rest wait their turn, first come first served. Transfers to different
+// peers all run at the same time.
+//
+// And one device gone haywire shouldn't take us down with it. Each source address can
+// only have so many incoming transfers going at once, and can only start so many in a
+// while. Over the limit, broadcasts are ignored and request to sends get a busy abort.
+// Flooding, they're just ignored. A new BAM from a source replaces the one it was
+// sending, like J1939 says. Set these with setSourceLimits(), zero turns either off.
+// What each source has been up to is kept in a sourceStats. Look it up with findSource().
+
+class xferPolicy :	public linkListObj {
+
+	public:
+				xferPolicy(uint32_t inPGN);
+	virtual	~xferPolicy(void);
+	
+				uint32_t	PGN;			// Who this is for.
+				uint8_t	rxPrio;		// How important incoming transfers of this PGN are.
+				int		txGap;		// Time between our outgoing data packets. -1 means use the class default.
+				bool		hasRetry;	// Do we have our own retry policy?
+				xferRetry	retry;	// If so, here it is.
+};
+
+
+class sourceStats :	public linkListObj {
+
+	public:
+				sourceStats(byte inAddr);
+	virtual	~sourceStats(void);
+	
+				bool		tally(int maxNum,int windowMs);			// Count an announce. false if it's one too many.
+				
+				byte				addr;				// Who this is.
+				uint32_t			announces;		// BAMs and request to sends we've seen from them.
+				uint32_t			refused;			// Turned away, too many running.
+				uint32_t			flooded;			// Ignored, too many too fast.
+				uint32_t			superseded;		// Broadcasts dropped because they started a new one.
+				unsigned long	winStart;		// When this counting window started.
+				int				winCount;		// Announces so far this window.
 };
 
 
@@ -625,6 +1133,39 @@ public:
 	virtual	~xferList(void);
 	
 				void		begin(netObj* inNetObj);
+				void		addSink(xferSink* inSink);
+				xferSink*	findSink(uint32_t PGN);
+				xferPolicy*	findPolicy(uint32_t PGN,bool create=false);
+				void		setPriority(uint32_t PGN,uint8_t prio);
+				uint8_t	getPriority(uint32_t PGN);
+				void		setRxBudget(uint32_t numBytes);
+				uint32_t	getRxBudget(void);
+				uint32_t	rxBytesUsed(void);
+				bool		canEvict(xferNode* victim,xferNode* forNode);
+				bool		makeRoom(xferNode* forNode);
+				void		setHighWater(int numMsgs,uint32_t numBytes);
+				bool		backedUp(xferNode* forNode,bool resuming);
+				void		setBAMGap(int ms);
+				void		setP2PGap(int ms);
+				void		setTxGap(uint32_t PGN,int ms);
+				void		setFastPacing(bool onOff);
+				int		getTxGap(uint32_t PGN,bool broadcast);
+				int		getMinGap(bool broadcast);
+				void		setRetry(xferRetry* inRetry);
+				void		setRetry(uint32_t PGN,xferRetry* inRetry);
+				xferRetry*	getRetry(uint32_t PGN);
+				void		scheduleBAM(void);
+				bool		peerBusy(byte peerAddr);
+				xferNode*	nextForPeer(byte peerAddr);
+				void		schedulePeers(void);
+				long		nextTxMs(void);
+				void		serviceTx(void);
+				void		setSourceLimits(int maxSessions,int maxAnnounce,int windowMs);
+				sourceStats*	findSource(byte srcAddr,bool create=false);
+				int		sessionsFrom(byte srcAddr);
+				int		supersedeBAM(byte srcAddr);
+				void		refuseXfer(message* reqMsg,abortReason reason);
+				void		admitXfer(message* ioMsg,xferTypes xferType);
 	virtual	void		addXfer(message* ioMsg,xferTypes xferType);
 				bool		checkList(message* ioMsg);
 				bool		handleMsg(message* ioMsg,bool received);
@@ -633,6 +1174,24 @@ public:
 	virtual	void  	idle(void);
 	
 				netObj*	ourNetObj;
+				linkList	sinkList;		// Anyone wanting transfers streamed to them.
+				linkList	policyList;		// Per PGN, how we treat their transfers.
+				uint32_t	rxBudget;		// How much RAM incoming transfers can have. Zero, no limit.
+				int		qHighWater;		// Hold senders when the message queue gets this deep.
+				uint32_t	poolHighWater;	// Or when others' reassembly RAM goes over this.
+				outgoingBroadcast*	activeBAM;	// The one broadcast that's allowed to be sending.
+				xferHandle*	nextHandle;		// sendXfer() leaves this for the next outgoing transfer we create.
+				txPacer	bamPacer;		// The clock all outgoing broadcasts share.
+				int		bamGap;			// Default gap between broadcast packets.
+				int		p2pGap;			// Default gap between peer to peer packets.
+				bool		fastPacing;		// Closed segment, ignore J1939's broadcast gap limits.
+				xferRetry	defRetry;		// Retry policy for transfers without their own.
+				uint32_t	bamSeqNum;		// Hands out queue order to outgoing broadcasts.
+				uint32_t	peerSeqNum;		// Hands out line order to outgoing peer to peer transfers.
+				linkList	sourceList;		// Per source address, what they've been up to.
+				int		srcMaxSessions;	// Incoming transfers at once, per source.
+				int		srcMaxAnnounce;	// New transfers per window, per source.
+				int		srcWindowMs;		// The window.
 };
 
 
@@ -644,12 +1203,42 @@ public:
 
 // The idea is that messages can come in in bursts. Instead of handling each one as it
 // comes in, we just copy them to this queue to be handled as we have time.
+//
+// Not all messages are equal though. Address claims, requests, acks and commanded
+// addresses have timers running on them. They can't wait behind a pile of periodic
+// data. So they get their own line, the control queue, and it always goes first. The
+// rest, the data, waits in the queue proper. There's a limit to how deep it all gets.
+// Past that we shed data. The oldest single frame data message goes first. Big
+// transfers are kept, they're throttled at the source already. (See setRxHighWater())
+// Control messages are never shed.
+//
+// Some PGNs are just the latest reading. Heading ten times a second, engine rapid update.
+// If we've fallen behind, the old ones waiting in line are useless. Mark those PGNs with
+// setCoalesce() and a new frame from a source replaces the one from that source still
+// waiting, right where it sits. So the line only ever holds one per stream, no matter how
+// fast they come. A stream is a PGN from a source. And for PDU1 PGNs, to a destination.
+// What one source sends to two different addresses is two streams.
+
+class coalescePGN :	public linkListObj {
+
+	public:
+				coalescePGN(uint32_t inPGN);
+	virtual	~coalescePGN(void);
+	
+				uint32_t	PGN;	// Only the latest of these matters.
+};
+
 
 class msgObj :	public linkListObj,
 					public message {
 	public:
 				msgObj(message* inMsg);
+				msgObj(message* inMsg,frameClass inClass,bool inForUs);
 	virtual	~msgObj(void);
+	
+				frameClass	rxClass;		// What kind it is. Worked out once, on the way in.
+				bool			forUs;		// Broadcast, or sent to our address. Same.
+				bool			isRequest;	// A request, the right size, for us. Same.
 };					
 					
 
@@ -658,10 +1247,230 @@ class msgQ :	public queue {
 public:
 				msgQ(void);
 	virtual	~msgQ(void);
+	
+	virtual	void				push(linkListObj* newObj);
+	virtual	linkListObj*	pop(void);
+				int				getDepth(void);
+				int				getCtrlDepth(void);
+				bool				isControl(msgObj* aMsg);		// Does this one jump the line?
+				bool				shedData(void);					// Make room. false if there's nothing we can shed.
+				void				setCoalesce(uint32_t PGN,bool onOff);	// Only keep the latest of this PGN, per source.
+				bool				wantsCoalesce(uint32_t PGN);			// Is this one of those?
+				bool				coalesce(message* inMsg);				// Replace a waiting one with this? true if we did.
+				
+				queue				ctrlQ;		// Network management. Goes first.
+				int				depth;		// How many are waiting, both queues. Counted as they come and go.
+				int				ctrlDepth;	// How many of those are control.
+				int				maxDepth;	// Most we hold before shedding data. Zero for no limit.
+				uint32_t			shed;			// How many data messages we've had to throw away.
+				linkList			coalesceList;	// PGNs we only keep the latest of.
+				uint32_t			coalesced;	// How many were replaced by newer ones.
+};
+
+
+
+// ***************************************************************************************
+//				     ----- rxRing. Frames straight from the hardware. -----
+// ***************************************************************************************
+
+
+// The msgQ costs a couple trips to the heap for every frame that goes in. No good from an
+// interrupt, or from a driver's own receive thread. So the raw frames land in here first.
+// A fixed ring of slots, one writer, one reader. The driver's interrupt (or thread) is the
+// writer, it calls put(). idle() is the reader, it calls get(). Each side only ever writes
+// its own index, so no locks are needed. If the ring is full the frame is dropped and
+// counted. Check getOverflows() to see if you are losing any.
+//
+// The indexes are bytes and just keep counting, rolling over at 256. That's why the size
+// has to be a power of two. A byte is read and written in one go on everything we run on,
+// so neither side can catch the other half way through an update.
+
+struct rxSlot {
+
+	uint32_t	CANID;			// The whole 29 bit ID.
+	uint8_t	numBytes;		// 0..8
+	uint8_t	data[8];			// The frame's data.
+};
+
+
+class rxRing {
+
+	public:
+				rxRing(void);
+	virtual	~rxRing(void);
+	
+				bool		put(uint32_t CANID,uint8_t numBytes,const uint8_t* data);	// Writer. ISR safe. false if full. (And counted)
+				bool		get(message* outMsg);											// Reader. Fills in outMsg. false if empty.
+				uint8_t	getDepth(void);													// How many are waiting.
+				uint32_t	getOverflows(void);												// How many we've had to drop.
+				void		resetOverflows(void);											// Start counting over.
+				
+				volatile uint8_t	head;						// Writer's index. Only put() changes it.
+				rxSlot				slots[RX_RING_SIZE];	// The frames. Keeps head and tail apart, too.
+				volatile uint8_t	tail;						// Reader's index. Only get() changes it.
+				volatile uint32_t	overflows;				// Dropped 'cause we were full. Writer counts these.
 };
 
 
 
+// ***************************************************************************************
+//				     ----- fastHandler. For what can't wait. -----
+// ***************************************************************************************
+
+
+// Everything that comes in waits in the queue for the next idle(). Usually that's fine. But
+// if your loop() is busy drawing a screen, a throttle command or a shutdown alarm waits
+// right along with everything else. A fastHandler is for those. Add it to the netObj with
+// addFastHandler() for the PGNs it wants, and rxFrame() hands it those frames right then
+// and there. From your driver's interrupt, or its receive thread. No queue, no idle().
+//
+// Which means you're in interrupt land. Be quick. Don't allocate, don't print, don't send.
+// You get the PGN, who sent it and the raw bytes. Copy what you need, set a flag, flip a
+// pin. Return true if you dealt with it and it needn't be queued. false and it goes on to
+// the regular handlers like any other frame. Single frames only. Big transfers have to be
+// put together first, so they always wait.
+//
+// There's only room for FAST_LANE_MAX of them. Add them during setup, before the frames
+// start coming in. They can't be taken back out.
+
+class fastHandler {
+
+	public:
+				fastHandler(void);
+	virtual	~fastHandler(void);
+	
+	virtual	bool	fastFrame(uint32_t PGN,byte sourceAddr,uint8_t numBytes,const uint8_t* data);	// Fill in. true if it's dealt with, don't queue it.
+};
+
+
+struct fastEntry {
+
+	uint32_t			PGN;			// The PGN. (basePGN() of it)
+	fastHandler*	handler;		// Who gets it.
+};
+
+
+
+// ***************************************************************************************
+//				     ----- pgnIndex. Who wants what PGN. -----
+// ***************************************************************************************
+
+
+// Walking every handler for every message, each one working out the PGN just to say "not
+// mine", gets expensive once you have a few dozen of them. So handlers can tell us what
+// PGNs they want when they're added. Those go in here. Single PGNs are kept in an array,
+// sorted by PGN, and found with a binary search. So the cost stays about the same no
+// matter how many there are. Ranges of PGNs are rarer, they go in a short list of their
+// own. Same PGN more than once? They're kept in the order the handlers were first added
+// to the netObj. Everyone who wants a PGN gets it, in that order.
+//
+// Handlers that didn't say what they want are kept in an array of their own, in the order
+// they were added. Every message goes to them, so that's only as long as the number of
+// them. None? Then it costs nothing. Indexed handlers are never walked past.
+//
+// PGNs are stored as basePGN(). Destination address stripped off the PDU1 ones.
+
+
+struct pgnEntry {
+
+	uint32_t		PGN;			// The PGN..
+	msgHandler*	handler;		// And who wants it.
+};
+
+
+class pgnRange :	public linkListObj {
+
+	public:
+				pgnRange(uint32_t inFirstPGN,uint32_t inLastPGN,msgHandler* inHandler);
+	virtual	~pgnRange(void);
+	
+				uint32_t		firstPGN;	// From here..
+				uint32_t		lastPGN;		// To here. Inclusive.
+				msgHandler*	handler;		// Goes to them.
+};
+
+
+class pgnIndex {
+
+	public:
+				pgnIndex(void);
+	virtual	~pgnIndex(void);
+	
+				bool		addPGN(uint32_t PGN,msgHandler* inHandler);								// false if we ran out of RAM.
+				bool		addRange(uint32_t firstPGN,uint32_t lastPGN,msgHandler* inHandler);	// Same.
+				int		findFirst(uint32_t PGN);													// Index of the first entry for this PGN. -1 if none.
+				bool		inRange(pgnRange* aRange,uint32_t PGN);								// Does this range cover this PGN?
+				bool		addPlain(msgHandler* inHandler);											// One that wants everything. false if we ran out of RAM.
+				void		dropPlain(msgHandler* inHandler);										// It said what it wants after all.
+				
+				pgnEntry*		entries;		// The sorted array.
+				int				numEntries;	// How many are in it.
+				int				maxEntries;	// How many it can hold before it grows.
+				linkList			ranges;		// The ranges, in the order they were added.
+				msgHandler**	plain;		// The ones that didn't say, in the order they were added.
+				int				numPlain;	// How many of those.
+				int				maxPlain;	// Room for this many before it grows.
+};
+
+
+
+// ***************************************************************************************
+//				     ----- filterSet. What the CAN hardware should let in. -----
+// ***************************************************************************************
+
+
+// Most of what goes by on the bus is none of our business. CAN controllers can throw it
+// away for us, before it ever bothers the processor, if we tell them what we do want.
+// They take ID and mask pairs. A frame gets in if its ID matches the filter's ID in every
+// bit that's set in the mask. These are 29 bit extended IDs, same as getCANID().
+//
+// The netObj builds a set of these from the PGNs its handlers asked for, plus what it
+// needs to run the network. Address claims, requests, transport protocol, acks. PDU1 ones
+// only to us or to everyone. Priority and source address are always let through. The
+// hardware only has so many filters, so if we have more than that, we merge the two
+// that are the closest match into one that takes both. 'Till it fits. Merged filters let
+// in more than we want, that's fine. The software checks everything anyway.
+//
+// If there's a handler that didn't say what PGNs it wants, it wants everything. Then the
+// set is one filter that lets everything in.
+
+struct canFilter {
+
+	uint32_t	id;		// Bits we want to see..
+	uint32_t	mask;		// In these positions. Zero bits are "don't care".
+};
+
+
+class filterSet {
+
+	public:
+				filterSet(void);
+	virtual	~filterSet(void);
+	
+				void		clear(void);												// Empty it out.
+				bool		addFilter(uint32_t id,uint32_t mask);				// Add one. false if we ran out of RAM.
+				void		addPGN(uint32_t PGN,byte ourAddr);					// Add a PGN. PDU1 ones, to us and to everyone.
+				void		addRange(uint32_t firstPGN,uint32_t lastPGN);	// A range of PGNs. (Maybe a bit more.)
+				void		acceptAll(void);											// One filter that lets everything in.
+				void		reduce(int maxFilters);									// Merge 'till there's no more than this many.
+				bool		covers(canFilter* a,canFilter* b);					// Does a let in everything b does?
+				canFilter	merged(canFilter* a,canFilter* b);				// One filter that lets in both.
+				int		countBits(uint32_t value);								// How many bits are set.
+				
+				canFilter*	filters;			// The set.
+				int			numFilters;		// How many in it.
+				int			maxFilters;		// Room for this many before it grows.
+};
+
+
+
+// A router is a plain function, and whatever it needs to find itself again. (context)
+// Gets the message and the PGN it goes by. Returns true if anyone claimed it. See
+// staticRouter.h for one the compiler builds for you.
+typedef bool (*routeFunc)(void* context,message* inMsg,uint32_t PGN);
+
+
+
 // ***************************************************************************************
 //		----- netObj. Base class for allowing navigation of SAE J1939 networks -----
 // ***************************************************************************************
@@ -732,12 +1541,55 @@ class netObj :	public linkList,
 	
 	virtual	void		begin(byte inAddr,addrCat inAddCat);										// ** YOU WILL NEED TO CALL THIS BEFORE USE ** - Initial setup.
 	virtual	void		addMsgHandler(msgHandler* inHanldler);										// ** USE THIS TO ADD YOUR HANDLER OBJECTS FOR THE MESSAGEDS YOU WANT TO SEND/RECEIVE **
+				void		addMsgHandler(msgHandler* inHanldler,uint32_t PGN);					// ** OR THIS, IF IT ONLY WANTS THIS PGN. CALL AGAIN FOR EACH PGN IT WANTS. **
+				void		addMsgHandler(msgHandler* inHanldler,uint32_t firstPGN,uint32_t lastPGN);	// ** OR A RANGE OF THEM. **
+				bool		haveHandler(msgHandler* inHanldler);											// Is this one already on our list?
+				void		setRouter(routeFunc inRouter,void* context);								// Incoming messages go through this first. (See staticRouter.h) NULL for none.
+				void		addFilterPGN(uint32_t PGN);													// Have the hardware filters let this PGN in too. Needed for PGNs only a router wants.
+				void		setFilterLimit(int maxFilters);												// How many acceptance filters your hardware has. Zero for no limit.
+				int		getNumFilters(void);																// How many filters in the set..
+				canFilter	getFilter(int index);														// And each one.
+				void		rebuildFilters(void);															// Work out the filter set again. Done for you when handlers or our address change.
+	virtual	void		filtersChanged(void);															// ** FILL THIS IN TO PROGRAM YOUR CAN HARDWARE'S FILTERS **
+				bool		dispatchMsg(message* inMsg,bool isRequest);								// Hand a message to every handler that wants it. true if one claimed it.
+				bool		dispatchPGN(message* inMsg,uint32_t PGN,bool withPlain);				// Same, to the ones that want this PGN. (And, withPlain, the ones that didn't say.)
+				void		addXferSink(xferSink* inSink);												// ** USE THIS TO HAVE BIG INCOMING TRANSFERS STREAMED TO YOU **
+				void		setRxBudget(uint32_t numBytes);												// How much RAM incoming transfers can use, all together. Zero for no limit.
+				void		setXferPriority(uint32_t PGN,uint8_t prio);								// How important incoming transfers of this PGN are. 0 highest, 7 lowest.
+				void		setRxHighWater(int numMsgs,uint32_t numBytes);							// Hold peer to peer senders when we're this backed up. Zero turns off.
+				void		setBAMGap(int ms);																// Time between outgoing broadcast packets. J1939 says 50..200 ms.
+				void		setP2PGap(int ms);																// Time between outgoing peer to peer (ETP) data packets.
+				void		setTxGap(uint32_t PGN,int ms);												// This PGN gets its own gap. -1 goes back to default.
+				void		setFastPacing(bool onOff);														// Closed segment? Broadcast gaps can go below 50 ms.
+				long		nextTxMs(void);																	// How long 'till a data packet is due? -1 for nothing waiting.
+				void		serviceTx(void);																	// Send any data packets that are due. idle() calls this too.
+				void		setRetry(xferRetry* inRetry);													// How outgoing peer to peer transfers retry on busy or timeout.
+				void		setRetry(uint32_t PGN,xferRetry* inRetry);								// Or, how this PGN's do.
+				void		setBusRate(uint32_t bitsPerSec);												// Bus speed for bandwidth budgeting. 250K default.
+				void		setBandwidth(bwClass aClass,uint8_t percent);							// Share of the bus a class of frames can use. Zero for no limit.
+				void		setSourceLimits(int maxSessions,int maxAnnounce,int windowMs);		// Per source, incoming transfers at once and how many can start per window.
+				sourceStats*	getSourceStats(byte srcAddr);												// What's this source been up to? NULL if we've not heard from them.
 	virtual  void		sendMsg(message* outMsg)=0;													// ** YOU WRITE THIS ONE TO SEND 8 BYTE OR SMALLER MESSAGES. DON'T CALL IT! **
 	virtual  void		incomingMsg(message* inMsg);													// ** WHEN A MESSAGE COMES IN FROM THE HARDWARE, PASS IT IN HERE. **
+				bool		rxFrame(uint32_t CANID,uint8_t numBytes,const uint8_t* data);		// ** OR THIS. SAFE FROM AN INTERRUPT OR RECEIVE THREAD. ** false if we had to drop it.
+				uint32_t	getRxOverflows(void);															// Frames rxFrame() had to drop 'cause idle() fell behind.
+				bool		addFastHandler(fastHandler* inHandler,uint32_t PGN);					// ** FOR THE FEW PGNS THAT CAN'T WAIT. rxFrame() calls it directly. ** false if full.
+				bool		checkFastLane(uint32_t CANID,uint8_t numBytes,const uint8_t* data);	// rxFrame() offers frames here first. true if a fast handler took it.
+				void		checkRxRing(void);																// Drain the receive ring into incomingMsg(). idle() calls this.
+				void		setRxDrain(int maxMsgs,unsigned long maxUs);								// How much incoming work one idle() does. Messages, microseconds. Zero for no limit.
+				int		getRxDepth(void);																	// How many incoming frames and messages are waiting to be dealt with.
+				void		setRxQDepth(int maxMsgs);														// Most messages the incoming queue holds before it sheds data. Zero for no limit.
+				uint32_t	getRxShed(void);																	// How many data messages were shed 'cause we fell behind.
+				void		setCoalesce(uint32_t PGN,bool onOff=true);								// Incoming, only the latest of this PGN from each source is kept waiting.
+				uint32_t	getRxCoalesced(void);															// How many stale ones were replaced before anyone saw them.
+				void		setSignalStore(signalStore* inStore);										// Where handlers keep their last values, for anyone to read. NULL for none.
+				signalStore*	getSignalStore(void);														// And here it is.
 	virtual  void		outgoingingMsg(message* inMsg);												// ** USE THIS TO SEND MESSAGES ** IT CAN HANDLE >8 BYTE MESSAGES AND WILL CALL sendMsg() FOR YOU.
+				bool		sendXfer(message* inMsg,xferHandle* inHandle);							// ** SAME, BUT THE HANDLE TELLS YOU HOW IT WENT. ** False if the handle's already busy.
 				bool		isBusy();																			// ** USE TO SEE IF WE ARE IN A WAIT STATE **
 				void		refreshAddrList(void);															// ** USE THIS TO CLEAR THEN REFRESH THE ADDRESS LIST, GIVE IT A SECOND TO COMPLETE. **
-				void		checkMessages(void);																// If we have one we'll grab it and deal with it. -(Can have > 8 data bytes)-
+				void		checkMessages(void);																// Deal with waiting messages, as many as the drain limits allow.
+				bool		handleNextMsg(void);																// If we have one we'll grab it and deal with it. false if none. -(Can have > 8 data bytes)-
 				void		startHoldTimer(void);															// Calculate and start the address holding time delay. Function of address.
 				void		clearErr(void);																	// This will clear the address error and restart the process.
 				void		changeState(netObjState newState);											// Keeping track of what we are up to.
@@ -754,12 +1606,13 @@ class netObj :	public linkList,
 				uint32_t getRequestPGN(message* reqMsg);												// Returns the PGN encoded in a request messages's data.
 				void		setRequestPGN(uint32_t PGN, message* reqMsg);							// Encodes a PGN into a request message's data.
 				void		returnAck(ackType inType,message* reqMsg);								// Needed to acknowledge peer to peer requests.
+				bool		isForUs(message* inMsg);														// Broadcast, or sent to our address?
 				bool		isRequestMsg(message* inMsg);													// Is this a request msg?
-				bool		isAddrClaimReq(message* inMsg);												// Is this specifically and address claim request, aimed at us?
+				bool		isAddrClaimReq(msgObj* inMsg);												// Is this specifically and address claim request, aimed at us?
 				void		handelAddrClaimReq(message* inMsg);											// Handle an address claimed msg.
 				bool		isAddrClaim(message* inMsg);													// Is this an address claimed msg?
 				bool		isCantClaim(message* inMsg);													// Is this a fail to claim address msg?
-				bool		isCommandedAddr(message* inMsg);												// Is this a commanded address msg?
+				bool		isCommandedAddr(msgObj* inMsg);												// Is this a commanded address msg?
 				
 				void		handleAddrClaim(message* inMsg);											// Handle an address claimed msg.
 				void		handleCantClaim(message* inMsg);												// Handle a failed to claim an address msg.				
@@ -778,7 +1631,21 @@ class netObj :	public linkList,
 				
 	virtual	void			idle(void);																		// Keeping things running.
 	
+				rxRing		ourRxRing;																		// Raw frames from rxFrame(), waiting for idle().
+				fastEntry	fastLane[FAST_LANE_MAX];													// Who gets what, right from rxFrame().
+				volatile uint8_t	numFast;																	// How many of those are filled in.
 				msgQ			ourMsgQ;																			// A place to store incoming messages.
+				pgnIndex		ourPGNIndex;																	// Who wants what PGN.
+				uint32_t		handlerSeq;																		// Handlers are numbered as they're added. Sets the order they're called.
+				uint32_t		dispatchNum;																	// Each message handed out gets a number. So no handler sees one twice.
+				routeFunc	ourRouter;																		// Compiled in handlers, if any.
+				void*			routerContext;																	// And what it needs to find them.
+				filterSet	ourFilters;																		// What the CAN hardware should let in.
+				linkList		extraFilterPGNs;																// PGNs added with addFilterPGN(). (As one PGN pgnRanges.)
+				int			filterLimit;																	// How many filters the hardware can take.
+				signalStore*	ourSignals;																	// Last values, if we have a store.
+				int			rxMaxMsgs;																		// Most messages checkMessages() deals with per call.
+				unsigned long	rxMaxUs;																		// Most time it spends doing it.
 				
 				netObjState	ourState;																		// What state we are in now.
 				timeObj		holdTimer;																		// Our timer for startup holding.
@@ -791,6 +1658,7 @@ class netObj :	public linkList,
 				addrList		ourAddrList;																	// List of used addresses from the network.
 				
 				xferList		ourXferList;																	// The transport protocol list.
+				bandwidthMgr	ourBandwidth;																// Who's using how much of the bus.
 };
 
 
@@ -802,22 +1670,93 @@ class netObj :	public linkList,
 
 // Base class for handling and creation of SAE J1939 network messages. Inherit this create
 // your handler object and add them using the netObj call addMsgHandler().
+//
+// Every handler that wants a message gets it. A logger, a display and an alarm can all
+// watch the same PGN. They're called in the order they were added, and they're all
+// handed the same message. So look, don't change it. Return true from handleMsg() if
+// the message was yours. That "claims" it. Nobody else misses out, but if it was a
+// request aimed at us and no one claims it, we send back a NACK.
+//
+// Want other parts of your program, other threads even, to see what you read? Hand the
+// values to storeSignal() from your handleMsg(). They land in the netObj's signalStore,
+// if it has one. (See signalStore.h)
 class msgHandler :	public linkListObj {	
 
 	public:
 				msgHandler(netObj* inNetObj);
 				~msgHandler(void);
 				
-	virtual  bool	handleMsg(message* inMsg);		// Fill in to handle messages.
+	virtual  bool	handleMsg(message* inMsg);		// Fill in to handle messages. true claims it. (See above)
 	virtual  void	newMsg(void);						// Fill in to create messages.
 	virtual  void	sendMsg(message* inMsg);		// This one just sends messages on their way.
 	
+				bool	storeSignal(message* inMsg,byte instance,byte field,float value);	// Post a value read from inMsg to our netObj's signalStore.
 				void	setSendInterval(float inMs);	// Used for broadcasting. (Zero for off)
             float	getSendInterval(void);			//
 	virtual	void	idleTime(void);					// Same as idle, but called by the netObj.
 				
 				netObj*	ourNetObj;						// Pointer to our boss!
 				timeObj	intervaTimer;					// If broadcasting, how often do we broadcast? (Ms)
+				bool		indexed;							// Added by PGN? Then we only see those PGNs.
+				uint32_t	regSeq;							// When we were added. Earlier handlers are called first.
+				uint32_t	lastDispatch;					// The last message we were handed. So we don't get it twice.
+};
+
+
+
+// ***************************************************************************************
+//				                   ----- xferBuilder -----
+// ***************************************************************************************
+
+
+// For writing big outgoing messages. Instead of building a message, filling it a byte at
+// a time and then having the transfer pull it apart, begin() grabs a transfer buffer of
+// the size you need. Then you put() your fields in, in order, and they are written
+// straight into the buffer's chunks. commit() sends it off as a transfer. Bytes you never
+// wrote go out as 0xFF. (Unused) Run off the end and the extra is dropped and overflow
+// is set. Byte ordering is the same as the message class set..InData() calls.
+
+class xferBuilder {
+
+	public:
+				xferBuilder(netObj* inNetObj);
+	virtual	~xferBuilder(void);
+
+				bool		begin(uint32_t inPGN,uint32_t inNumBytes,byte inPriority=DEF_PRIORITY);	// Reserve the buffer. PDU1 PGNs carry the destination.
+				uint32_t	getNumBytes(void);									// How big it is.
+				uint32_t	getIndex(void);										// Where the next put() goes.
+				void		seek(uint32_t inIndex);								// Move to here.
+				bool		getOverflow(void);									// Did someone try to write past the end?
+				
+				void		putByte(byte inByte);								// These write the value and move past it.
+				void		putInt(int16_t value);								//
+				void		putUInt(uint16_t value);							//
+				void		putLong(int32_t value);								//
+				void		putULong(uint32_t value);							//
+				void		putDLong(int64_t value);							//
+				void		putDULong(uint64_t value);							//
+				void		putPGN(uint32_t PGN);								// PGNs take three bytes.
+				void		putString(const char* inStr);						// The characters, no terminator.
+				void		putString(const char* inStr,uint32_t fieldBytes,byte pad=0xFF);	// Fixed size field, padded out.
+				void		fill(byte value,uint32_t numBytes);				// numBytes of value.
+				void		putBytes(const byte* inData,uint32_t numBytes);	// A block of bytes.
+				
+				bool		commit(xferHandle* inHandle=NULL);				// Send it. The buffer is handed over. false if it wouldn't go.
+				void		cancel(void);											// Toss it.
+
+	protected:
+				bool		nextRun(void);											// Point runPtr into the chunk we're at.
+				void		advance(uint32_t numBytes);						// Slide past what we just wrote.
+				void		putValue(uint64_t value,int numBytes);			// Low byte first, like the rest of J1939.
+				
+				netObj*		ourNetObj;		// Who sends it.
+				xferBuff*	ourBuff;			// Where it's being built.
+				uint32_t		PGN;				// What it is.
+				byte			priority;		// How important.
+				uint32_t		index;			// Next byte goes here.
+				byte*			runPtr;			// Straight into the current chunk..
+				uint32_t		runBytes;		// For this many bytes.
+				bool			overflow;		// Wrote off the end?
 };
 
 
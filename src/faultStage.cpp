@@ -0,0 +1,214 @@
+#include <faultStage.h>
+
+
+//				                  -----    heldFrame    -----
+
+
+heldFrame::heldFrame(message* inMsg,unsigned long inDueMs)
+	: msgObj(inMsg) { dueMs = inDueMs; }
+
+
+heldFrame::~heldFrame(void) {  }
+
+
+
+// ***************************************************************************************
+//				                   -----    faultStage    -----
+// ***************************************************************************************
+
+
+faultStage::faultStage(void)
+	: linkList(), idler() {
+
+	seed(1);					// Something to start with.
+	lossPct		= 0;		// Everything off.
+	toBadPct		= 0;		//
+	toGoodPct	= 0;		//
+	badLossPct	= 0;		//
+	inBad			= false;	//
+	dupPct		= 0;		//
+	reorderPct	= 0;		//
+	reorderMs	= 0;		//
+	delayMin		= 0;		//
+	delayMax		= 0;		//
+	nextStage	= NULL;	// No one after us.
+	resetStats();			// No counts.
+}
+
+
+// The linkList recycles anything we were still holding.
+faultStage::~faultStage(void) {  }
+
+
+// xorshift can't start from zero. It'd stay there.
+void faultStage::seed(uint32_t inSeed) {
+
+	if (!inSeed) inSeed = 1;
+	rngState = inSeed;
+}
+
+
+void faultStage::setLoss(float percent) { lossPct = percent; }
+
+
+// Each frame, when good there's a toBadPct chance of going bad. When bad, toGoodPct of
+// coming back. While bad, frames are lost at badLossPct. Average burst runs about
+// 100/toGoodPct frames.
+void faultStage::setBurstLoss(float inToBadPct,float inToGoodPct,float inBadLossPct) {
+
+	toBadPct		= inToBadPct;
+	toGoodPct	= inToGoodPct;
+	badLossPct	= inBadLossPct;
+	inBad			= false;
+}
+
+
+void faultStage::setDup(float percent) { dupPct = percent; }
+
+
+void faultStage::setReorder(float percent,int holdMs) {
+
+	reorderPct	= percent;
+	reorderMs	= holdMs;
+}
+
+
+void faultStage::setDelay(int minMs,int maxMs) {
+
+	if (maxMs<minMs) maxMs = minMs;
+	delayMin = minMs;
+	delayMax = maxMs;
+}
+
+
+void faultStage::setNext(faultStage* inNext) { nextStage = inNext; }
+
+
+void faultStage::resetStats(void) {
+
+	framesIn		= 0;
+	framesOut	= 0;
+	lost			= 0;
+	duplicated	= 0;
+	reordered	= 0;
+	delayed		= 0;
+}
+
+
+// xorshift32. Small, quick and plenty random for rolling dice.
+uint32_t faultStage::random32(void) {
+
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+
+// percent chance of true.
+bool faultStage::chance(float percent) {
+
+	if (percent<=0) return false;
+	if (percent>=100) return true;
+	return (random32()/4294967296.0)*100<percent;
+}
+
+
+// A frame comes in. Roll for all the bad things that can happen to it.
+void faultStage::push(message* inMsg) {
+
+	int				copies;
+	unsigned long	delayMs;
+
+	if (!inMsg) return;													// Sanity.
+	framesIn++;																// Count it.
+	if (toBadPct>0) {														// Burst loss running?
+		if (inBad) {														// Bad now..
+			if (chance(toGoodPct)) inBad = false;					// Maybe it clears up.
+		} else {																// Good now..
+			if (chance(toBadPct)) inBad = true;						// Maybe it goes bad.
+		}																		//
+	}																			//
+	if (chance(lossPct) || (inBad && chance(badLossPct))) {	// Lost?
+		lost++;																// Gone.
+		return;																// That's all.
+	}																			//
+	copies = 1;																// Usually one.
+	if (chance(dupPct)) {												// But maybe..
+		copies = 2;															// Two.
+		duplicated++;														//
+	}																			//
+	for (int i=0;i<copies;i++) {										// For each copy..
+		delayMs = delayMin;												// Least latency.
+		if (delayMax>delayMin) {										// If there's a spread..
+			delayMs = delayMs + random32()%(delayMax-delayMin+1);	// Somewhere in it.
+		}																		//
+		if (chance(reorderPct)) {										// Held back?
+			delayMs = delayMs + reorderMs;							// Longer then.
+			reordered++;													//
+		}																		//
+		if (delayMs) {														// Late?
+			hold(inMsg,millis()+delayMs);								// Park it.
+			delayed++;														//
+		} else {																// On time.
+			emit(inMsg);													// Out it goes.
+		}
+	}
+}
+
+
+// Park a copy 'till it's due. The list stays sorted by due time, and ones due at the same
+// time stay in the order they came in. So plain latency doesn't reorder anything.
+void faultStage::hold(message* inMsg,unsigned long inDueMs) {
+
+	heldFrame*	newFrame;
+	heldFrame*	trace;
+	heldFrame*	prev;
+
+	newFrame = new heldFrame(inMsg,inDueMs);						// Copy it.
+	if (!newFrame) {														// No RAM?
+		lost++;																// Call it lost.
+		return;																//
+	}																			//
+	prev = NULL;															// Find the last one..
+	trace = (heldFrame*)getFirst();									//
+	while(trace && (long)(trace->dueMs-inDueMs)<=0) {			// Due at or before us.
+		prev = trace;														//
+		trace = (heldFrame*)trace->getNext();						//
+	}																			//
+	if (prev) {																// Someone's ahead of us?
+		newFrame->linkAfter(prev);										// Go after them.
+	} else {																	// Else..
+		addToTop(newFrame);												// We're first.
+	}
+}
+
+
+void faultStage::emit(message* outMsg) {
+
+	framesOut++;
+	output(outMsg);
+}
+
+
+// Default, hand it to the next stage. No next stage, it just goes away. Inherit and fill
+// this in to get it somewhere useful.
+void faultStage::output(message* outMsg) {
+
+	if (nextStage) nextStage->push(outMsg);
+}
+
+
+// Let out whatever's due. Oldest first.
+void faultStage::idle(void) {
+
+	heldFrame*	trace;
+
+	trace = (heldFrame*)getFirst();
+	while(trace && (long)(millis()-trace->dueMs)>=0) {		// While the first one is due..
+		unlinkObj(trace);													// Off the list.
+		emit(trace);														// Send it.
+		delete(trace);														// Recycle it.
+		trace = (heldFrame*)getFirst();								// Next.
+	}
+}
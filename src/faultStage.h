@@ -0,0 +1,85 @@
+#ifndef faultStage_h
+#define faultStage_h
+
+#include <SAE_J1939.h>
+
+
+// ***************************************************************************************
+//				                   ----- faultStage -----
+// ***************************************************************************************
+
+
+// A real bus loses frames. Noise, a loose connector, somebody's bilge pump. Sitting on the
+// bench with two boards and a short cable, you never see it. So this is a place to make
+// it happen, on purpose, so you can see how the transfers hold up.
+//
+// A faultStage sits between the driver and the netObj. Frames go in with push() and come
+// out of output(). In between they can be lost, duplicated, held back so later ones pass
+// them, or delayed. Each by a percent chance. Loss can also come in bursts, the way it
+// does on a real bus. That's a Gilbert-Elliott model. Two states, good and bad. Each
+// frame we may flip from good to bad, or back, and when it's bad frames are lost at a
+// much higher rate.
+//
+// All the dice come from our own seeded random numbers. Same seed, same faults. So a run
+// that breaks something can be run again the same way 'till you fix it.
+//
+// Hook up output() to whatever is next. Inherit and fill it in to call the other side's
+// incomingMsg(), or your hardware. Or use setNext() to chain stages. One for loss, one
+// for delay.. Compose away. Delayed frames are let out in idle(). So call hookup().
+
+class heldFrame :	public msgObj {
+
+	public:
+				heldFrame(message* inMsg,unsigned long inDueMs);
+	virtual	~heldFrame(void);
+
+				unsigned long	dueMs;	// When we let it go.
+};
+
+
+class faultStage :	public linkList,
+							public idler {
+
+	public:
+				faultStage(void);
+	virtual	~faultStage(void);
+
+				void		seed(uint32_t inSeed);										// Start the dice here.
+				void		setLoss(float percent);										// Chance any one frame is lost.
+				void		setBurstLoss(float toBadPct,float toGoodPct,float badLossPct);	// Gilbert-Elliott. Zero toBadPct for off.
+				void		setDup(float percent);										// Chance a frame shows up twice.
+				void		setReorder(float percent,int holdMs);					// Chance a frame's held back holdMs. Later ones pass it.
+				void		setDelay(int minMs,int maxMs);							// Every frame is late by minMs..maxMs.
+				void		setNext(faultStage* inNext);								// Chain another stage after us.
+				void		push(message* inMsg);										// A frame comes in.
+	virtual	void		output(message* outMsg);									// And goes out. Default passes it to the next stage.
+				void		resetStats(void);												// Clear the counters.
+	virtual	void		idle(void);														// Let out delayed frames that are due.
+
+				uint32_t	random32(void);												// Next random number.
+				bool		chance(float percent);										// Roll the dice.
+				void		hold(message* inMsg,unsigned long inDueMs);			// Park a frame 'till inDueMs.
+				void		emit(message* outMsg);										// Count it and send it on its way.
+
+				uint32_t		rngState;		// The dice.
+				float			lossPct;			// Plain loss.
+				float			toBadPct;		// Burst loss, chance of going bad.
+				float			toGoodPct;		// And coming back.
+				float			badLossPct;		// Loss while it's bad.
+				bool			inBad;			// Are we bad right now?
+				float			dupPct;			// Duplicates.
+				float			reorderPct;		// Held back.
+				int			reorderMs;		// For this long.
+				int			delayMin;		// Latency, least..
+				int			delayMax;		// And most.
+				faultStage*	nextStage;		// Who's after us.
+
+				uint32_t		framesIn;		// Counters. Frames in..
+				uint32_t		framesOut;		// Out. (Duplicates count twice)
+				uint32_t		lost;				// Lost.
+				uint32_t		duplicated;		// Sent twice.
+				uint32_t		reordered;		// Held back.
+				uint32_t		delayed;			// Held for latency.
+};
+
+#endif
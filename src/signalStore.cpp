@@ -0,0 +1,126 @@
+#include <signalStore.h>
+
+
+// ***************************************************************************************
+//				                   -----    signalStore    -----
+// ***************************************************************************************
+
+
+// All the slots come from the heap the one time, here. After that nothing's allocated.
+signalStore::signalStore(int maxSignals) {
+
+	slots		= NULL;		// resizeBuff() wants a NULL to start.
+	maxSlots	= 0;
+	numSlots	= 0;
+	dropped	= 0;
+	if (maxSignals>0) {
+		if (resizeBuff(maxSignals,&slots)) {
+			maxSlots = maxSignals;
+		}
+	}
+}
+
+
+signalStore::~signalStore(void) { resizeBuff(0,&slots); }
+
+
+// The writer. Find its slot, or take a new one, and write it in.
+bool signalStore::update(uint32_t PGN,byte source,byte instance,byte field,float value) {
+
+	signalSlot*	slot;
+	int			index;
+
+	index = findSignal(PGN,source,instance,field);		// Seen it before?
+	if (index>=0) {												// We have..
+		updateSlot(index,value);								// Write it in.
+		return true;												// Done.
+	}																	//
+	if (numSlots>=maxSlots) {									// New one and we're full?
+		dropped++;													// Count it.
+		return false;												// And that's it.
+	}																	//
+	slot = &(slots[numSlots]);									// The next free slot.
+	slot->PGN		= PGN;										// Fill in the key.
+	slot->source	= source;									//
+	slot->instance	= instance;									//
+	slot->field		= field;										//
+	slot->seq		= 0;											// Nothing written yet.
+	slot->updates	= 0;											//
+	updateSlot(numSlots,value);								// Its first value.
+	__sync_synchronize();										// All that lands before..
+	numSlots = numSlots+1;										// Readers can see it.
+	return true;
+}
+
+
+// Odd while we're in here. Anyone who reads across it sees the change and tries again.
+void signalStore::updateSlot(int index,float value) {
+
+	signalSlot*	slot;
+
+	if (index<0 || index>=maxSlots) return;				// Sanity.
+	slot = &(slots[index]);										// Our slot.
+	slot->seq = slot->seq+1;									// Odd, we're writing.
+	__sync_synchronize();										// Readers see that first.
+	slot->value		= value;										// Write it.
+	slot->timeMs	= millis();									//
+	slot->updates	= slot->updates+1;						//
+	__sync_synchronize();										// All that lands before..
+	slot->seq = slot->seq+1;									// Even, we're done.
+}
+
+
+// Slots in use never move and their keys never change. So anyone can look.
+int signalStore::findSignal(uint32_t PGN,byte source,byte instance,byte field) {
+
+	signalSlot*	slot;
+	int			count;
+
+	count = numSlots;												// Only these are ready.
+	__sync_synchronize();										// See them as they were when count moved.
+	for (int i=0;i<count;i++) {								// Look through them..
+		slot = &(slots[i]);										//
+		if (slot->PGN==PGN && slot->source==source && slot->instance==instance && slot->field==field) {
+			return i;												// Found it.
+		}																//
+	}																	//
+	return -1;														// Not here.
+}
+
+
+bool signalStore::read(uint32_t PGN,byte source,byte instance,byte field,signalSnap* snap) {
+
+	return readSlot(findSignal(PGN,source,instance,field),snap);
+}
+
+
+// The reader side. Copy it out between two looks at seq. If they match, and it's even,
+// the writer wasn't in there and the copy is good.
+bool signalStore::readSlot(int index,signalSnap* snap) {
+
+	signalSlot*	slot;
+	uint32_t		startSeq;
+
+	if (!snap || index<0 || index>=numSlots) return false;	// Sanity.
+	slot = &(slots[index]);												// Our slot.
+	for (int i=0;i<SIG_READ_TRIES;i++) {							// Give it a few goes..
+		startSeq = slot->seq;											// Where's the writer?
+		if (startSeq & 1) continue;									// In there, try again.
+		__sync_synchronize();											// Read seq before the slot.
+		snap->value		= slot->value;									// Copy it out.
+		snap->timeMs	= slot->timeMs;								//
+		snap->updates	= slot->updates;								//
+		__sync_synchronize();											// Read the slot before seq.
+		if (slot->seq==startSeq) return true;						// Nobody touched it, good copy.
+	}																			//
+	return false;															// Writer kept beating us to it.
+}
+
+
+int signalStore::getNumSignals(void) { return numSlots; }
+
+
+int signalStore::getMaxSignals(void) { return maxSlots; }
+
+
+uint32_t signalStore::getDropped(void) { return dropped; }
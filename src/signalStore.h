@@ -0,0 +1,80 @@
+#ifndef signalStore_h
+#define signalStore_h
+
+#include <SAE_J1939.h>
+
+
+// ***************************************************************************************
+//				                   ----- signalStore -----
+// ***************************************************************************************
+
+
+// Every handler ends up keeping its own copy of the last value it read. Boat speed in one,
+// water temp in another.. Fine 'till someone else wants it. Your display task, a logger
+// running on the other core, whatever. Now they're reading a float while the network loop
+// is half way through writing it. And there's no telling how old it is either.
+//
+// So, one place for all of them. Each value is found by what message it came in on, who
+// sent it, which instance it's for (Tank 0, tank 1..) and which field of the message it
+// is. Your handler pulls the value out of the message and hands it to storeSignal(). That
+// happens in the network loop, same as now. Anyone else, from any thread, calls read()
+// and gets the value, when it was written and how many times it's been written.
+//
+// No locks. The network loop never waits on anyone. Each slot has a sequence number that
+// the writer bumps to odd before it starts and back to even when it's done. A reader
+// grabs the number, copies the slot, then looks at the number again. Odd, or changed? It
+// read while the writer was in there, so it tries again. That's called a seqlock. The
+// reader may have to try more than once, but the writer never does.
+//
+// There's only ever one writer, the network loop. Slots are set up when a value is first
+// written and stay there. When they're all used, new values are dropped and counted.
+// Find a slot once with findSignal() and read it by index after that, it saves the
+// looking.
+
+#define SIG_READ_TRIES	8		// How many times a reader goes for a clean copy before giving up.
+
+
+// What a reader gets back. A clean copy, all from the same write.
+struct signalSnap {
+
+	float				value;		// The last value written.
+	unsigned long	timeMs;		// millis() when it was written.
+	uint32_t			updates;		// How many times it's been written.
+};
+
+
+struct signalSlot {
+
+	uint32_t					PGN;			// The key. Set once when the slot's taken.
+	uint8_t					source;		// Who sent it.
+	uint8_t					instance;	// Which one of them.
+	uint8_t					field;		// Which field of the message.
+	volatile uint32_t		seq;			// Odd while it's being written.
+	volatile float			value;		// What we were handed.
+	volatile unsigned long	timeMs;	// When.
+	volatile uint32_t		updates;		// How many times.
+};
+
+
+class signalStore {
+
+	public:
+				signalStore(int maxSignals);
+	virtual	~signalStore(void);
+
+				bool		update(uint32_t PGN,byte source,byte instance,byte field,float value);	// Writer. false if it didn't fit. (And counted)
+				void		updateSlot(int index,float value);															// Writer. Same, if you know the slot.
+				int		findSignal(uint32_t PGN,byte source,byte instance,byte field);			// Anyone. Index of the slot, -1 if there isn't one.
+				bool		read(uint32_t PGN,byte source,byte instance,byte field,signalSnap* snap);	// Anyone. false if we've not seen it, or couldn't get a clean copy.
+				bool		readSlot(int index,signalSnap* snap);													// Anyone. Same, by index.
+				int		getNumSignals(void);																			// Slots in use.
+				int		getMaxSignals(void);																			// Slots we have.
+				uint32_t	getDropped(void);																				// Writes that found no slot.
+
+				signalSlot*		slots;		// All of them.
+				int				maxSlots;	// How many there are.
+				volatile int	numSlots;	// How many are in use. Readers only look this far.
+				uint32_t			dropped;		// No room for them.
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef staticRouter_h
+#define staticRouter_h
+
+#include <SAE_J1939.h>
+
+
+// ***************************************************************************************
+//				                   ----- staticRouter -----
+// ***************************************************************************************
+
+
+// On a lot of boards the set of handlers is fixed the day you compile. There's no need to
+// keep them in a list, walk it, and make a virtual call on each one to find who wants a
+// message. The compiler knows all of it already. So, hand it the list..
+//
+//		staticRouter<speedHandler,depthHandler,tempHandler> ourRouter(&speed,&depth,&temp);
+//		..
+//		ourRouter.attach(&ourNetObj);
+//
+// Each handler class needs two things :
+//
+//		static bool takesPGN(uint32_t PGN);		// true for the PGNs it wants. Write it as a switch.
+//		bool handleMsg(message* inMsg);			// Same as a msgHandler's. true claims it.
+//
+// They don't have to inherit anything. No msgHandler, no linkListObj. So no vtables and
+// no list pointers. The router is built out of nested templates, one layer per handler.
+// Every takesPGN() and handleMsg() is a plain call the compiler can see, so it inlines
+// them and the whole thing folds down to a chain of compares and direct calls. If one
+// of your classes does inherit msgHandler, that's fine too. We call its handleMsg()
+// directly, not through the vtable.
+//
+// Same rules as the regular handlers. Everyone who wants a message gets it, in the order
+// you listed them. Requests come in under the PGN that's being requested. The netObj
+// calls the router before any handlers added with addMsgHandler(). Those still work, if
+// you need a mix. The router only deals with incoming messages. Sending and idle time are
+// still up to your handlers.
+
+
+template<typename... handlers>
+class staticRouter;
+
+
+// The bottom layer. Nothing left, so no one takes anything.
+template<>
+class staticRouter<> {
+
+	public:
+				staticRouter(void) {  }
+
+				bool			route(message* inMsg,uint32_t PGN) { return false; }
+	static	bool			takesPGN(uint32_t PGN) { return false; }
+};
+
+
+// One layer per handler. This one's handler, then the rest of them underneath.
+template<typename handler,typename... others>
+class staticRouter<handler,others...> :	public staticRouter<others...> {
+
+	public:
+				staticRouter(handler* inHandler,others*... inOthers)
+					: staticRouter<others...>(inOthers...) { ourHandler = inHandler; }
+
+
+	// Ours first, then everyone after us. true if anyone claimed it.
+				bool route(message* inMsg,uint32_t PGN) {
+
+					bool	claimed;
+
+					claimed = false;
+					if (handler::takesPGN(PGN)) {
+						claimed = ourHandler->handler::handleMsg(inMsg);
+					}
+					if (staticRouter<others...>::route(inMsg,PGN)) claimed = true;
+					return claimed;
+				}
+
+
+	// Does anyone in here want this PGN?
+	static	bool takesPGN(uint32_t PGN) {
+
+					return handler::takesPGN(PGN) || staticRouter<others...>::takesPGN(PGN);
+				}
+
+
+	// Hook ourselves into a netObj. From now on it hands us its messages.
+				void attach(netObj* inNetObj) { inNetObj->setRouter(&routeThunk,this); }
+
+
+	// What the netObj actually calls. A plain function, it gets us back from context.
+	static	bool routeThunk(void* context,message* inMsg,uint32_t PGN) {
+
+					return ((staticRouter<handler,others...>*)context)->route(inMsg,PGN);
+				}
+
+				handler*	ourHandler;	// Who we call.
+};
+
+#endif